@@ -0,0 +1,72 @@
+// Measures concurrent game lookups, as done by getGame for games already in
+// memory: lock the shard, find the game, then lock the game itself. The
+// sharded GameTable is compared against a single GameTableShard holding every
+// game behind one lock, which is how the table was kept before it was split.
+// Only a host with more than one CPU can show a difference between them.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "game_table.hpp"
+
+#define BENCH_GAMES (10000)
+#define BENCH_LOOKUPS_PER_THREAD (2000000)
+
+// Runs lookups of random player IDs on the given number of threads, returning
+// millions of lookups per second
+template <class Lookup>
+double run_threads(uint32_t threads, Lookup lookup) {
+  std::vector<std::thread> runners;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t t = 0; t < threads; ++t) {
+    runners.emplace_back([t, &lookup]() {
+      uint32_t seed = (t + 1) * 7919;
+      for (uint32_t i = 0; i < BENCH_LOOKUPS_PER_THREAD; ++i) {
+        seed = seed * 1103515245 + 12345;
+        lookup((seed >> 8) % BENCH_GAMES);
+      }
+    });
+  }
+  for (std::thread& runner : runners) {
+    runner.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  return (double)threads * BENCH_LOOKUPS_PER_THREAD / seconds / 1e6;
+}
+
+int main() {
+  static GameTable table(BENCH_GAMES);
+  static GameTableShard single;
+  single.max_games = BENCH_GAMES;
+  for (uint32_t player_id = 0; player_id < BENCH_GAMES; ++player_id) {
+    std::shared_ptr<ServerGame> game = std::make_shared<ServerGame>(
+        player_id, "word", std::nullopt, LetterIndex("word"));
+    GameTableShard& shard = table.shardFor(player_id);
+    shard.insert(player_id, game);
+    single.insert(player_id, game);
+  }
+
+  std::cout << "[game_table] " << std::thread::hardware_concurrency()
+            << " CPU(s), " << BENCH_GAMES << " games, "
+            << BENCH_LOOKUPS_PER_THREAD << " lookups per thread" << std::endl;
+  for (uint32_t threads : {1u, 2u, 4u, 8u, 16u}) {
+    double single_rate = run_threads(threads, [](uint32_t player_id) {
+      std::scoped_lock<std::mutex> slock(single.lock);
+      ServerGameSync game(single.find(player_id));
+    });
+    double sharded_rate = run_threads(threads, [](uint32_t player_id) {
+      GameTableShard& shard = table.shardFor(player_id);
+      std::scoped_lock<std::mutex> slock(shard.lock);
+      ServerGameSync game(shard.find(player_id));
+    });
+    std::cout << "[game_table] " << threads << " thread(s): single lock "
+              << single_rate << " M/s, sharded " << sharded_rate << " M/s"
+              << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+// Measures sending a hint file over a loopback TCP connection, once through
+// TcpResponse, which uses sendfile, and once through the chunked pread/write
+// copy that TcpResponse falls back to, which was its only path before.
+// A second thread reads and discards everything that is received.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/common.hpp"
+#include "tcp_connection.hpp"
+
+#define BENCH_FILE_SIZE (64 * 1024 * 1024)  // 64 MiB
+#define BENCH_DOWNLOADS (10)
+#define BENCH_RECEIVE_BUFFER_LEN (64 * 1024)
+#define BENCH_HEADER "RHL OK hint.txt 67108864 "
+
+// Returns a connected pair of loopback TCP sockets, the first one being
+// non-blocking, as in the TCP loops
+void connect_loopback(int& sender_fd, int& receiver_fd) {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  if (listen_fd == -1 ||
+      bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      listen(listen_fd, 1) == -1 ||
+      getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) == -1) {
+    throw UnrecoverableError("Failed to listen on loopback", errno);
+  }
+
+  receiver_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (receiver_fd == -1 ||
+      connect(receiver_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    throw UnrecoverableError("Failed to connect on loopback", errno);
+  }
+  sender_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+  if (sender_fd == -1) {
+    throw UnrecoverableError("Failed to accept on loopback", errno);
+  }
+  close(listen_fd);
+}
+
+void wait_writable(int fd) {
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+  poll(&pfd, 1, -1);
+}
+
+void send_with_response(int fd, const std::filesystem::path& path) {
+  TcpResponse response;
+  response.data = BENCH_HEADER;
+  response.attachFile(path);
+  while (!response.write(fd)) {
+    wait_writable(fd);
+  }
+}
+
+void send_with_copy(int fd, const std::filesystem::path& path) {
+  if (::write(fd, BENCH_HEADER, strlen(BENCH_HEADER)) == -1) {
+    throw UnrecoverableError("Failed to write header", errno);
+  }
+  int file_fd = open(path.c_str(), O_RDONLY);
+  char chunk[FILE_BUFFER_LEN];
+  size_t offset = 0;
+  while (true) {
+    ssize_t n = pread(file_fd, chunk, FILE_BUFFER_LEN, (off_t)offset);
+    if (n <= 0) {
+      break;
+    }
+    offset += (size_t)n;
+    size_t sent = 0;
+    while (sent < (size_t)n) {
+      ssize_t written = ::write(fd, chunk + sent, (size_t)n - sent);
+      if (written == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          throw UnrecoverableError("Failed to write chunk", errno);
+        }
+        wait_writable(fd);
+        continue;
+      }
+      sent += (size_t)written;
+    }
+  }
+  close(file_fd);
+}
+
+void bench_send(const char* name, const std::filesystem::path& path,
+                void (*send)(int, const std::filesystem::path&)) {
+  int sender_fd, receiver_fd;
+  connect_loopback(sender_fd, receiver_fd);
+
+  size_t expected =
+      (size_t)BENCH_DOWNLOADS * (BENCH_FILE_SIZE + strlen(BENCH_HEADER));
+  std::thread receiver([receiver_fd, expected]() {
+    std::vector<char> buffer(BENCH_RECEIVE_BUFFER_LEN);
+    size_t received = 0;
+    while (received < expected) {
+      ssize_t n = read(receiver_fd, buffer.data(), buffer.size());
+      if (n <= 0) {
+        abort();
+      }
+      received += (size_t)n;
+    }
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_DOWNLOADS; ++i) {
+    send(sender_fd, path);
+  }
+  receiver.join();
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << "[hint_send] " << name << ": "
+            << (double)BENCH_DOWNLOADS * BENCH_FILE_SIZE / seconds / 1e6
+            << " MB/s" << std::endl;
+  close(sender_fd);
+  close(receiver_fd);
+}
+
+int main() {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "hint_send_bench.dat";
+  {
+    // Filled with something other than zeros, so nothing is special-cased
+    std::string block(1024 * 1024, 'h');
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    for (uint32_t i = 0; i < BENCH_FILE_SIZE / block.length(); ++i) {
+      if (fd == -1 || ::write(fd, block.data(), block.length()) == -1) {
+        throw UnrecoverableError("Failed to create the hint file", errno);
+      }
+    }
+    close(fd);
+  }
+
+  bench_send("sendfile (TcpResponse)", path, send_with_response);
+  bench_send("pread/write copy", path, send_with_copy);
+  std::filesystem::remove(path);
+  return EXIT_SUCCESS;
+}
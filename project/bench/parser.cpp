@@ -0,0 +1,63 @@
+// Measures parsing UDP requests with PacketReader, including the packet ID.
+// Each datagram is copied into a buffer first, as alphabetical strings are
+// lowercased in place. Heap allocations are counted as well.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include "common/protocol.hpp"
+
+#define BENCH_ITERATIONS (1000000)
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  void *ptr = malloc(size);
+  if (ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t size) noexcept {
+  (void)size;
+  free(ptr);
+}
+
+template <class Packet>
+void bench_packet(const char *datagram) {
+  size_t length = strlen(datagram);
+  char buffer[SOCKET_BUFFER_LEN];
+  uint64_t checksum = 0;
+
+  allocations = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_ITERATIONS; ++i) {
+    memcpy(buffer, datagram, length);
+    PacketReader reader(buffer, length);
+    if (reader.readAnyPacketId() != packet_id_code(Packet::ID)) {
+      abort();
+    }
+    Packet packet;
+    packet.deserialize(reader);
+    checksum += packet.trial;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  std::cout << "[parser] " << Packet::ID << ": "
+            << ns / BENCH_ITERATIONS << " ns/packet, "
+            << (double)allocations / BENCH_ITERATIONS
+            << " allocation(s)/packet (checksum " << checksum << ")"
+            << std::endl;
+}
+
+int main() {
+  bench_packet<GuessLetterServerbound>("PLG 099123 e 3\n");
+  bench_packet<GuessWordServerbound>("PWG 099123 computer 5\n");
+  return EXIT_SUCCESS;
+}
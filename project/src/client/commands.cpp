@@ -6,10 +6,9 @@
 #include <iostream>
 
 #include "client_game.hpp"
+#include "common/common.hpp"
 #include "common/protocol.hpp"
 
-extern bool is_shutting_down;
-
 void CommandManager::printHelp() {
   std::cout << std::endl << "Available commands:" << std::endl << std::left;
 
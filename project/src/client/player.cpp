@@ -12,8 +12,6 @@
 
 #include "common/common.hpp"
 
-extern bool is_shutting_down;
-
 int main(int argc, char *argv[]) {
   try {
     setup_signal_handlers();
@@ -23,7 +21,7 @@ int main(int argc, char *argv[]) {
       config.printHelp(std::cout);
       return EXIT_SUCCESS;
     }
-    PlayerState state(config.host, config.port);
+    PlayerState state(config.host, config.port, config.keep_alive);
 
     CommandManager commandManager;
     registerCommands(commandManager);
@@ -91,7 +89,7 @@ ClientConfig::ClientConfig(int argc, char *argv[]) {
   program_path = argv[0];
   int opt;
 
-  while ((opt = getopt(argc, argv, "hn:p:")) != -1) {
+  while ((opt = getopt(argc, argv, "hkn:p:")) != -1) {
     switch (opt) {
       case 'n':
         host = std::string(optarg);
@@ -99,6 +97,9 @@ ClientConfig::ClientConfig(int argc, char *argv[]) {
       case 'p':
         port = std::string(optarg);
         break;
+      case 'k':
+        keep_alive = true;
+        break;
       case 'h':
         help = true;
         break;
@@ -113,12 +114,15 @@ ClientConfig::ClientConfig(int argc, char *argv[]) {
 }
 
 void ClientConfig::printHelp(std::ostream &stream) {
-  stream << "Usage: " << program_path << " [-n GSIP] [-p GSport] [-h]"
+  stream << "Usage: " << program_path << " [-n GSIP] [-p GSport] [-k] [-h]"
          << std::endl;
   stream << "Available options:" << std::endl;
   stream << "-n GSIP\t\tSet hostname of Game Server. Default: "
          << DEFAULT_HOSTNAME << std::endl;
   stream << "-p GSport\tSet port of Game Server. Default: " << DEFAULT_PORT
          << std::endl;
+  stream << "-k\t\tReuse the TCP connection for more than one request. The "
+            "server must be started with -k too."
+         << std::endl;
   stream << "-h\t\tPrint this menu." << std::endl;
 }
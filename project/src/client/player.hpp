@@ -15,6 +15,7 @@ class ClientConfig {
   std::string host = DEFAULT_HOSTNAME;
   std::string port = DEFAULT_PORT;
   bool help = false;
+  bool keep_alive = false;
 
   ClientConfig(int argc, char* argv[]);
   void printHelp(std::ostream& stream);
@@ -7,7 +7,9 @@
 
 #include "common/common.hpp"
 
-PlayerState::PlayerState(std::string &hostname, std::string &port) {
+PlayerState::PlayerState(std::string &hostname, std::string &port,
+                         bool __keep_alive)
+    : keep_alive{__keep_alive} {
   this->setupSockets();
   this->resolveServerAddress(hostname, port);
 }
@@ -109,26 +111,47 @@ void PlayerState::waitForUdpPacket(UdpPacket &packet) {
 void PlayerState::sendTcpPacketAndWaitForReply(TcpPacket &out_packet,
                                                TcpPacket &in_packet) {
   try {
-    openTcpSocket();
+    if (!isTcpConnectionAlive()) {
+      closeTcpSocket();
+      openTcpSocket();
+      connectTcpSocket();
+    }
     sendTcpPacket(out_packet);
     waitForTcpPacket(in_packet);
   } catch (...) {
     closeTcpSocket();
     throw;
   }
-  closeTcpSocket();
+  if (!keep_alive) {
+    closeTcpSocket();
+  }
 };
 
 void PlayerState::sendTcpPacket(TcpPacket &packet) {
+  packet.send(tcp_socket_fd);
+}
+
+void PlayerState::waitForTcpPacket(TcpPacket &packet) {
+  packet.receive(*tcp_reader);
+}
+
+void PlayerState::connectTcpSocket() {
   if (connect(tcp_socket_fd, server_tcp_addr->ai_addr,
               server_tcp_addr->ai_addrlen) != 0) {
     throw ConnectionTimeoutException();
   }
-  packet.send(tcp_socket_fd);
+  tcp_reader = std::make_unique<TcpStreamReader>(tcp_socket_fd);
 }
 
-void PlayerState::waitForTcpPacket(TcpPacket &packet) {
-  packet.receive(tcp_socket_fd);
+bool PlayerState::isTcpConnectionAlive() {
+  if (tcp_reader == NULL || tcp_reader->getBufferedLength() > 0) {
+    return false;
+  }
+  // The server closes persistent connections once they have been idle for a
+  // while, which shows up as the end of the stream
+  char c;
+  ssize_t n = recv(tcp_socket_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
 }
 
 void PlayerState::openTcpSocket() {
@@ -154,7 +177,10 @@ void PlayerState::openTcpSocket() {
 }
 
 void PlayerState::closeTcpSocket() {
-  if (close(this->tcp_socket_fd) != 0) {
+  tcp_reader.reset();
+  int socket_fd = this->tcp_socket_fd;
+  this->tcp_socket_fd = -1;
+  if (close(socket_fd) != 0) {
     if (errno == EBADF) {
       // was already closed
       return;
@@ -3,12 +3,18 @@
 
 #include <netdb.h>
 
+#include <memory>
+
 #include "client_game.hpp"
 #include "common/protocol.hpp"
 
 class PlayerState {
   int udp_socket_fd = -1;
   int tcp_socket_fd = -1;
+  // Kept along with the TCP socket, since it might have read ahead
+  std::unique_ptr<TcpStreamReader> tcp_reader;
+  // Whether the TCP connection is reused for the next requests
+  bool keep_alive;
   struct addrinfo* server_udp_addr = NULL;
   struct addrinfo* server_tcp_addr = NULL;
 
@@ -17,6 +23,9 @@ class PlayerState {
   void sendUdpPacket(UdpPacket& packet);
   void waitForUdpPacket(UdpPacket& packet);
   void openTcpSocket();
+  void connectTcpSocket();
+  // Whether an open connection can still be reused
+  bool isTcpConnectionAlive();
   void sendTcpPacket(TcpPacket& packet);
   void waitForTcpPacket(TcpPacket& packet);
   void closeTcpSocket();
@@ -24,7 +33,7 @@ class PlayerState {
  public:
   ClientGame* game = NULL;
 
-  PlayerState(std::string& hostname, std::string& port);
+  PlayerState(std::string& hostname, std::string& port, bool __keep_alive);
   ~PlayerState();
   bool hasActiveGame();
   bool hasGame();
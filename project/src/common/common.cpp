@@ -1,8 +1,14 @@
 #include "common.hpp"
 
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 #include <csignal>
 
-bool is_shutting_down = false;
+std::atomic<bool> is_shutting_down{false};
+// Becomes readable once shutdown is requested, so threads blocked on epoll
+// can be woken up immediately
+int shutdown_event_fd = -1;
 
 void validate_port_number(std::string &port) {
   for (char c : port) {
@@ -45,5 +51,22 @@ void terminate_signal_handler(int sig) {
   if (is_shutting_down) {
     exit(EXIT_SUCCESS);
   }
+  request_shutdown();
+}
+
+void setup_shutdown_event() {
+  shutdown_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (shutdown_event_fd == -1) {
+    throw UnrecoverableError("Failed to create shutdown event", errno);
+  }
+}
+
+void request_shutdown() {
   is_shutting_down = true;
+  if (shutdown_event_fd != -1) {
+    // write is async-signal-safe, so this can be called from signal handlers
+    uint64_t value = 1;
+    ssize_t n = write(shutdown_event_fd, &value, sizeof(value));
+    (void)n;
+  }
 }
@@ -1,6 +1,7 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <atomic>
 #include <cstring>
 #include <stdexcept>
 
@@ -11,9 +12,15 @@ class UnrecoverableError : public std::runtime_error {
       : std::runtime_error(__what + ": " + strerror(__errno)) {}
 };
 
+// Set from the signal handlers and read by every thread, so it must be atomic
+extern std::atomic<bool> is_shutting_down;
+
 void validate_port_number(std::string& port);
 
 void setup_signal_handlers();
 void terminate_signal_handler(int sig);
 
+void setup_shutdown_event();
+void request_shutdown();
+
 #endif
@@ -10,9 +10,11 @@
 #define UDP_RESEND_TRIES (3)
 #define TCP_READ_TIMEOUT_SECONDS (15)
 #define TCP_WRITE_TIMEOUT_SECONDS (20 * 60)  // 20 minutes
-#define SERVER_RECV_RESTART_TIMEOUT_SECONDS (3)
+#define TCP_KEEP_ALIVE_IDLE_SECONDS (30)
+#define TCP_REQUEST_TIMEOUT_SECONDS (30)
 
 #define SOCKET_BUFFER_LEN (256)
+#define CACHED_REPLY_LEN (128)  // longest guess and reply kept for retransmits
 #define PACKET_ID_LEN (3)
 
 #define PLAYER_ID_MAX_LEN (6)
@@ -21,6 +23,7 @@
 #define EXCEPTION_RETRY_MAX (3)
 
 #define FILE_BUFFER_LEN (512)
+#define TCP_READ_BUFFER_LEN (1024)
 
 #define PROGRESS_BAR_STEP_SIZE (10)
 
@@ -31,6 +34,10 @@
 
 #define GAMEDATA_FOLDER_NAME ".gamedata"
 
+#define GAME_TABLE_SHARDS (64)         // must be a power of 2
+#define GAME_TABLE_MAX_GAMES (100000)  // default games kept in memory
+#define GAME_TABLE_EVICTION_PROBES (8)
+
 #define SCOREBOARD_MAX_ENTRIES (10)
 #define SCOREBOARD_FILE_NAME "scoreboard.dat"
 
@@ -41,6 +48,37 @@
 #define HELP_MENU_ALIAS_COLUMN_WIDTH (40)
 
 #define TCP_WORKER_POOL_SIZE (50)
-#define TCP_MAX_QUEUE_SIZE (5)
+#define TCP_WORKER_POOL_MIN (4)
+#define TCP_WORKERS_MAX (1024)
+#define TCP_BULK_WORKER_POOL_SIZE (8)  // threads for hint requests
+#define TCP_BULK_WORKER_POOL_MIN (1)
+#define TCP_WORKER_IDLE_SECONDS (30)
+#define TCP_CONNECTION_QUEUE_SIZE (256)
+#define TCP_CONNECTION_QUEUE_TIMEOUT_SECONDS (5)
+#define TCP_LOOPS_MAX (64)
+#define TCP_REQUEST_MAX_LEN (64)
+#define TCP_MAX_QUEUE_SIZE (128)  // default listen backlog
+#define TCP_BACKLOG_MAX (65535)
+#define TIMER_WHEEL_BITS (6)  // 64 slots per level
+#define TIMER_WHEEL_LEVELS (2)
+#define HINT_CACHE_SIZE (32)
+#define HINT_CACHE_MAX_FILE_SIZE (4 * 1024 * 1024)  // 4 MiB
+
+#define UDP_BATCH_SIZE (32)
+#define UDP_WORKERS_MAX (64)
+
+#define RATE_LIMIT_MAX (1000000)
+#define RATE_LIMIT_TABLE_SIZE (4096)  // must be a power of 2
+#define RATE_LIMIT_SHARDS (64)        // must be a power of 2
+#define RATE_LIMIT_MAX_PROBES (8)
+
+#define EVENT_LOOP_MAX_EVENTS (64)
+
+#define LOG_RING_SIZE (512)  // records per thread
+#define LOG_RECORD_ARGS_MAX (6)
+#define LOG_RECORD_TEXT_LEN (128)
+#define LOG_RATE_LIMIT_PER_SECOND (5000)  // records per thread
+#define LOG_FLUSH_INTERVAL_MS (10)
+#define LOG_DROPPED_REPORT_INTERVAL_SECONDS (5)
 
 #endif
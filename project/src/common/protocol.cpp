@@ -1,155 +1,241 @@
 #include "protocol.hpp"
 
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <charconv>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <string>
 
 #include "common.hpp"
 
-extern bool is_shutting_down;
+uint32_t PacketReader::readAnyPacketId() {
+  if (length - position <= PACKET_ID_LEN) {
+    throw InvalidPacketException();
+  }
+  uint32_t packet_id = packet_id_code(data + position);
+  position += PACKET_ID_LEN;
+  // The ID must be followed by the packet's fields or its delimiter
+  if (data[position] != ' ' && data[position] != '\n') {
+    throw InvalidPacketException();
+  }
+  return packet_id;
+}
 
-void UdpPacket::readPacketId(std::stringstream &buffer, const char *packet_id) {
-  char current_char;
+void PacketReader::readPacketId(const char *packet_id) {
   while (*packet_id != '\0') {
-    buffer >> current_char;
-    if (!buffer.good() || current_char != *packet_id) {
+    if (position >= length || data[position] != *packet_id) {
       throw UnexpectedPacketException();
     }
+    ++position;
     ++packet_id;
   }
 }
 
-void UdpPacket::readChar(std::stringstream &buffer, char chr) {
-  if (readChar(buffer) != chr) {
+void PacketReader::readChar(char chr) {
+  if (readChar() != chr) {
     throw InvalidPacketException();
   }
 }
 
-char UdpPacket::readChar(std::stringstream &buffer) {
-  char c;
-  buffer >> c;
-  if (!buffer.good()) {
+char PacketReader::readChar() {
+  if (position >= length) {
     throw InvalidPacketException();
   }
-  return c;
+  return data[position++];
 }
 
-char UdpPacket::readAlphabeticalChar(std::stringstream &buffer) {
-  char c;
-  buffer >> c;
-
-  if (!buffer.good() || !isalpha((unsigned char)c)) {
+char PacketReader::readAlphabeticalChar() {
+  char c = readChar();
+  if (!isalpha((unsigned char)c)) {
     throw InvalidPacketException();
   }
   return (char)tolower((unsigned char)c);
 }
 
-void UdpPacket::readSpace(std::stringstream &buffer) {
-  readChar(buffer, ' ');
+void PacketReader::readSpace() {
+  readChar(' ');
 }
 
-void UdpPacket::readPacketDelimiter(std::stringstream &buffer) {
-  readChar(buffer, '\n');
-  buffer.peek();
-  if (!buffer.eof()) {
+void PacketReader::readPacketDelimiter() {
+  readChar('\n');
+  if (position != length) {
     throw InvalidPacketException();
   }
 }
 
-std::string UdpPacket::readString(std::stringstream &buffer, uint32_t max_len) {
-  std::string str;
+std::string_view PacketReader::readString(uint32_t max_len) {
+  size_t start = position;
   uint32_t i = 0;
   while (i < max_len) {
-    char c = (char)buffer.get();
-    if (!buffer.good()) {
+    if (position >= length) {
       throw InvalidPacketException();
     }
+    char c = data[position];
     if (c == ' ' || c == '\n') {
-      buffer.unget();
       break;
     }
-    str += c;
+    ++position;
     ++i;
   }
-  return str;
+  return std::string_view(data + start, position - start);
 }
 
-std::string UdpPacket::readAlphabeticalString(std::stringstream &buffer,
-                                              uint32_t max_len) {
-  auto str = readString(buffer, max_len);
-  for (uint32_t i = 0; i < str.length(); ++i) {
-    if (!isalpha((unsigned char)str[i])) {
+std::string_view PacketReader::readAlphabeticalString(uint32_t max_len) {
+  size_t start = position;
+  auto str = readString(max_len);
+  for (size_t i = start; i < position; ++i) {
+    if (!isalpha((unsigned char)data[i])) {
       throw InvalidPacketException();
     }
-
-    str[i] = (char)tolower((unsigned char)str[i]);
+    // Lowercase the string in place, in the datagram buffer
+    data[i] = (char)tolower((unsigned char)data[i]);
   }
   return str;
 }
 
-uint32_t UdpPacket::readInt(std::stringstream &buffer) {
-  int64_t i;
-  buffer >> i;
-  if (!buffer.good() || i < 0 || i > INT32_MAX) {
+uint32_t PacketReader::readInt() {
+  // Accepts the same input as reading an int64_t from a stream: an optional
+  // sign followed by digits, which must not be the end of the packet
+  bool negative = false;
+  if (position < length && (data[position] == '+' || data[position] == '-')) {
+    negative = data[position] == '-';
+    ++position;
+  }
+
+  size_t start = position;
+  int64_t i = 0;
+  while (position < length && isdigit((unsigned char)data[position])) {
+    if (i <= INT32_MAX) {
+      i = i * 10 + (data[position] - '0');
+    }
+    ++position;
+  }
+
+  if (position == start || position >= length || (negative && i != 0) ||
+      i > INT32_MAX) {
     throw InvalidPacketException();
   }
   return (uint32_t)i;
 }
 
-uint32_t UdpPacket::readPlayerId(std::stringstream &buffer) {
-  std::string id_str = readString(buffer, 6);
-  return parse_packet_player_id(id_str);
+uint32_t PacketReader::readPlayerId() {
+  return parse_packet_player_id(readString(PLAYER_ID_MAX_LEN));
+}
+
+void UdpPacketWriter::write(char c) {
+  if (length >= capacity) {
+    throw PacketSerializationException();
+  }
+  data[length++] = c;
+}
+
+void UdpPacketWriter::write(std::string_view str) {
+  if (str.length() > capacity - length) {
+    throw PacketSerializationException();
+  }
+  memcpy(data + length, str.data(), str.length());
+  length += str.length();
+}
+
+void UdpPacketWriter::writeInt(uint32_t i) {
+  auto result = std::to_chars(data + length, data + capacity, i);
+  if (result.ec != std::errc()) {
+    throw PacketSerializationException();
+  }
+  length = (size_t)(result.ptr - data);
+}
+
+void UdpPacketWriter::writePlayerId(uint32_t player_id) {
+  if (player_id > PLAYER_ID_MAX || capacity - length < PLAYER_ID_MAX_LEN) {
+    throw PacketSerializationException();
+  }
+  // Zero-padded to PLAYER_ID_MAX_LEN digits, written from the right
+  for (size_t i = PLAYER_ID_MAX_LEN; i > 0; --i) {
+    data[length + i - 1] = (char)('0' + player_id % 10);
+    player_id /= 10;
+  }
+  length += PLAYER_ID_MAX_LEN;
+}
+
+size_t UdpPacketWriter::getLength() {
+  return length;
+}
+
+void LetterPositions::push_back(uint32_t position) {
+  if (count >= WORD_MAX_LEN) {
+    throw std::out_of_range("Too many letter positions");
+  }
+  positions[count++] = position;
+}
+
+void LetterPositions::clear() {
+  count = 0;
+}
+
+uint32_t LetterPositions::size() const {
+  return count;
+}
+
+const uint32_t *LetterPositions::begin() const {
+  return positions;
+}
+
+const uint32_t *LetterPositions::end() const {
+  return positions + count;
 }
 
 // Packet type seriliazation and deserialization methods
-std::stringstream StartGameServerbound::serialize() {
-  std::stringstream buffer;
-  buffer << StartGameServerbound::ID << " ";
-  write_player_id(buffer, player_id);
-  buffer << std::endl;
-  return buffer;
+void StartGameServerbound::serialize(UdpPacketWriter &writer) {
+  writer.write(StartGameServerbound::ID);
+  writer.write(' ');
+  writer.writePlayerId(player_id);
+  writer.write('\n');
 };
 
-void StartGameServerbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
+void StartGameServerbound::deserialize(PacketReader &reader) {
   // Serverbound packets don't read their ID
-  readSpace(buffer);
-  player_id = readPlayerId(buffer);
-  readPacketDelimiter(buffer);
+  reader.readSpace();
+  player_id = reader.readPlayerId();
+  reader.readPacketDelimiter();
 };
 
-std::stringstream ReplyStartGameClientbound::serialize() {
-  std::stringstream buffer;
-  buffer << ReplyStartGameClientbound::ID << " ";
+void ReplyStartGameClientbound::serialize(UdpPacketWriter &writer) {
+  writer.write(ReplyStartGameClientbound::ID);
+  writer.write(' ');
   if (status == ReplyStartGameClientbound::status::OK) {
-    buffer << "OK " << n_letters << " " << max_errors;
+    writer.write("OK ");
+    writer.writeInt(n_letters);
+    writer.write(' ');
+    writer.writeInt(max_errors);
   } else if (status == ReplyStartGameClientbound::status::NOK) {
-    buffer << "NOK";
+    writer.write("NOK");
   } else if (status == ReplyStartGameClientbound::status::ERR) {
-    buffer << "ERR";
+    writer.write("ERR");
   } else {
     throw PacketSerializationException();
   }
-  buffer << std::endl;
-  return buffer;
+  writer.write('\n');
 };
 
-void ReplyStartGameClientbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
-  readPacketId(buffer, ReplyStartGameClientbound::ID);
-  readSpace(buffer);
-  auto status_str = readString(buffer, 3);
+void ReplyStartGameClientbound::deserialize(PacketReader &reader) {
+  reader.readPacketId(ReplyStartGameClientbound::ID);
+  reader.readSpace();
+  auto status_str = reader.readString(3);
   if (status_str == "OK") {
     status = OK;
-    readSpace(buffer);
-    n_letters = readInt(buffer);
-    readSpace(buffer);
-    max_errors = readInt(buffer);
+    reader.readSpace();
+    n_letters = reader.readInt();
+    reader.readSpace();
+    max_errors = reader.readInt();
   } else if (status_str == "NOK") {
     status = NOK;
   } else if (status_str == "ERR") {
@@ -157,76 +243,84 @@ void ReplyStartGameClientbound::deserialize(std::stringstream &buffer) {
   } else {
     throw InvalidPacketException();
   }
-  readPacketDelimiter(buffer);
+  reader.readPacketDelimiter();
 };
 
-std::stringstream GuessLetterServerbound::serialize() {
-  std::stringstream buffer;
-  buffer << GuessLetterServerbound::ID << " ";
-  write_player_id(buffer, player_id);
-  buffer << " " << guess << " " << trial << std::endl;
-  return buffer;
+void GuessLetterServerbound::serialize(UdpPacketWriter &writer) {
+  writer.write(GuessLetterServerbound::ID);
+  writer.write(' ');
+  writer.writePlayerId(player_id);
+  writer.write(' ');
+  writer.write(guess);
+  writer.write(' ');
+  writer.writeInt(trial);
+  writer.write('\n');
 };
 
-void GuessLetterServerbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
+void GuessLetterServerbound::deserialize(PacketReader &reader) {
   // Serverbound packets don't read their ID
-  readSpace(buffer);
-  player_id = readPlayerId(buffer);
-  readSpace(buffer);
-  guess = readAlphabeticalChar(buffer);
-  readSpace(buffer);
-  trial = readInt(buffer);
+  reader.readSpace();
+  player_id = reader.readPlayerId();
+  reader.readSpace();
+  guess = reader.readAlphabeticalChar();
+  reader.readSpace();
+  trial = reader.readInt();
 
   if (trial < TRIAL_MIN || trial > TRIAL_MAX) {
     throw InvalidPacketException();
   }
 
-  readPacketDelimiter(buffer);
+  reader.readPacketDelimiter();
 };
 
-std::stringstream GuessLetterClientbound::serialize() {
-  std::stringstream buffer;
-  buffer << GuessLetterClientbound::ID << " ";
+void GuessLetterClientbound::serialize(UdpPacketWriter &writer) {
+  writer.write(GuessLetterClientbound::ID);
+  writer.write(' ');
   if (status == OK) {
-    buffer << "OK"
-           << " " << trial << " " << pos.size();
-    for (auto it = pos.begin(); it != pos.end(); ++it) {
-      buffer << " " << *it;
+    writer.write("OK ");
+    writer.writeInt(trial);
+    writer.write(' ');
+    writer.writeInt(pos.size());
+    for (uint32_t position : pos) {
+      writer.write(' ');
+      writer.writeInt(position);
     }
   } else if (status == WIN) {
-    buffer << "WIN " << trial;
+    writer.write("WIN ");
+    writer.writeInt(trial);
   } else if (status == DUP) {
-    buffer << "DUP " << trial;
+    writer.write("DUP ");
+    writer.writeInt(trial);
   } else if (status == NOK) {
-    buffer << "NOK " << trial;
+    writer.write("NOK ");
+    writer.writeInt(trial);
   } else if (status == OVR) {
-    buffer << "OVR " << trial;
+    writer.write("OVR ");
+    writer.writeInt(trial);
   } else if (status == INV) {
-    buffer << "INV " << trial;
+    writer.write("INV ");
+    writer.writeInt(trial);
   } else if (status == ERR) {
-    buffer << "ERR";
+    writer.write("ERR");
   } else {
     throw PacketSerializationException();
   }
-  buffer << std::endl;
-  return buffer;
+  writer.write('\n');
 };
 
-void GuessLetterClientbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
-  readPacketId(buffer, GuessLetterClientbound::ID);
-  readSpace(buffer);
-  auto success = readString(buffer, 3);
+void GuessLetterClientbound::deserialize(PacketReader &reader) {
+  reader.readPacketId(GuessLetterClientbound::ID);
+  reader.readSpace();
+  auto success = reader.readString(3);
 
   if (success == "ERR") {
     status = ERR;
-    readPacketDelimiter(buffer);
+    reader.readPacketDelimiter();
     return;
   }
 
-  readSpace(buffer);
-  trial = readInt(buffer);
+  reader.readSpace();
+  trial = reader.readInt();
 
   if (trial + 1 < TRIAL_MIN || trial > TRIAL_MAX) {
     throw InvalidPacketException();
@@ -234,12 +328,15 @@ void GuessLetterClientbound::deserialize(std::stringstream &buffer) {
 
   if (success == "OK") {
     status = OK;
-    readSpace(buffer);
-    uint32_t n = readInt(buffer);
+    reader.readSpace();
+    uint32_t n = reader.readInt();
+    if (n > WORD_MAX_LEN) {
+      throw InvalidPacketException();
+    }
     pos.clear();
     for (uint32_t i = 0; i < n; ++i) {
-      readSpace(buffer);
-      pos.push_back(readInt(buffer));
+      reader.readSpace();
+      pos.push_back(reader.readInt());
     }
   } else if (success == "WIN") {
     status = WIN;
@@ -254,74 +351,79 @@ void GuessLetterClientbound::deserialize(std::stringstream &buffer) {
   } else {
     throw InvalidPacketException();
   }
-  readPacketDelimiter(buffer);
+  reader.readPacketDelimiter();
 };
 
-std::stringstream GuessWordServerbound::serialize() {
-  std::stringstream buffer;
-  buffer << GuessWordServerbound::ID << " ";
-  write_player_id(buffer, player_id);
-  buffer << " " << guess << " " << trial << std::endl;
-  return buffer;
+void GuessWordServerbound::serialize(UdpPacketWriter &writer) {
+  writer.write(GuessWordServerbound::ID);
+  writer.write(' ');
+  writer.writePlayerId(player_id);
+  writer.write(' ');
+  writer.write(guess);
+  writer.write(' ');
+  writer.writeInt(trial);
+  writer.write('\n');
 };
 
-void GuessWordServerbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
+void GuessWordServerbound::deserialize(PacketReader &reader) {
   // Serverbound packets don't read their ID
-  readSpace(buffer);
-  player_id = readPlayerId(buffer);
-  readSpace(buffer);
-  guess = readAlphabeticalString(buffer, WORD_MAX_LEN);
+  reader.readSpace();
+  player_id = reader.readPlayerId();
+  reader.readSpace();
+  guess = reader.readAlphabeticalString(WORD_MAX_LEN);
   if (guess.length() < WORD_MIN_LEN || guess.length() > WORD_MAX_LEN) {
     throw InvalidPacketException();
   }
 
-  readSpace(buffer);
-  trial = readInt(buffer);
+  reader.readSpace();
+  trial = reader.readInt();
   if (trial < TRIAL_MIN || trial > TRIAL_MAX) {
     throw InvalidPacketException();
   }
 
-  readPacketDelimiter(buffer);
+  reader.readPacketDelimiter();
 };
 
-std::stringstream GuessWordClientbound::serialize() {
-  std::stringstream buffer;
-  buffer << GuessWordClientbound::ID << " ";
+void GuessWordClientbound::serialize(UdpPacketWriter &writer) {
+  writer.write(GuessWordClientbound::ID);
+  writer.write(' ');
   if (status == WIN) {
-    buffer << "WIN " << trial;
+    writer.write("WIN ");
+    writer.writeInt(trial);
   } else if (status == NOK) {
-    buffer << "NOK " << trial;
+    writer.write("NOK ");
+    writer.writeInt(trial);
   } else if (status == DUP) {
-    buffer << "DUP " << trial;
+    writer.write("DUP ");
+    writer.writeInt(trial);
   } else if (status == OVR) {
-    buffer << "OVR " << trial;
+    writer.write("OVR ");
+    writer.writeInt(trial);
   } else if (status == INV) {
-    buffer << "INV " << trial;
+    writer.write("INV ");
+    writer.writeInt(trial);
   } else if (status == ERR) {
-    buffer << "ERR";
+    writer.write("ERR");
   } else {
     throw InvalidPacketException();
   }
-  buffer << std::endl;
-  return buffer;
+  writer.write('\n');
 };
 
-void GuessWordClientbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
+void GuessWordClientbound::deserialize(PacketReader &reader) {
 
-  readPacketId(buffer, GuessWordClientbound::ID);
-  readSpace(buffer);
-  auto statusString = readString(buffer, 3);
+  reader.readPacketId(GuessWordClientbound::ID);
+  reader.readSpace();
+  auto statusString = reader.readString(3);
 
   if (statusString == "ERR") {
     status = ERR;
-    readPacketDelimiter(buffer);
+    reader.readPacketDelimiter();
     return;
   }
 
-  readSpace(buffer);
-  trial = readInt(buffer);
+  reader.readSpace();
+  trial = reader.readInt();
 
   if (trial + 1 < TRIAL_MIN || trial > TRIAL_MAX) {
     throw InvalidPacketException();
@@ -340,46 +442,42 @@ void GuessWordClientbound::deserialize(std::stringstream &buffer) {
   } else {
     throw InvalidPacketException();
   }
-  readPacketDelimiter(buffer);
+  reader.readPacketDelimiter();
 };
 
-std::stringstream QuitGameServerbound::serialize() {
-  std::stringstream buffer;
-  buffer << QuitGameServerbound::ID << " ";
-  write_player_id(buffer, player_id);
-  buffer << std::endl;
-  return buffer;
+void QuitGameServerbound::serialize(UdpPacketWriter &writer) {
+  writer.write(QuitGameServerbound::ID);
+  writer.write(' ');
+  writer.writePlayerId(player_id);
+  writer.write('\n');
 };
 
-void QuitGameServerbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
+void QuitGameServerbound::deserialize(PacketReader &reader) {
   // Serverbound packets don't read their ID
-  readSpace(buffer);
-  player_id = readPlayerId(buffer);
-  readPacketDelimiter(buffer);
+  reader.readSpace();
+  player_id = reader.readPlayerId();
+  reader.readPacketDelimiter();
 };
 
-std::stringstream QuitGameClientbound::serialize() {
-  std::stringstream buffer;
-  buffer << QuitGameClientbound::ID << " ";
+void QuitGameClientbound::serialize(UdpPacketWriter &writer) {
+  writer.write(QuitGameClientbound::ID);
+  writer.write(' ');
   if (status == OK) {
-    buffer << "OK";
+    writer.write("OK");
   } else if (status == NOK) {
-    buffer << "NOK";
+    writer.write("NOK");
   } else if (status == ERR) {
-    buffer << "ERR";
+    writer.write("ERR");
   } else {
     throw PacketSerializationException();
   }
-  buffer << std::endl;
-  return buffer;
+  writer.write('\n');
 };
 
-void QuitGameClientbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
-  readPacketId(buffer, QuitGameClientbound::ID);
-  readSpace(buffer);
-  auto status_str = readString(buffer, 3);
+void QuitGameClientbound::deserialize(PacketReader &reader) {
+  reader.readPacketId(QuitGameClientbound::ID);
+  reader.readSpace();
+  auto status_str = reader.readString(3);
   if (status_str == "OK") {
     status = OK;
   } else if (status_str == "NOK") {
@@ -389,57 +487,55 @@ void QuitGameClientbound::deserialize(std::stringstream &buffer) {
   } else {
     throw InvalidPacketException();
   }
-  readPacketDelimiter(buffer);
+  reader.readPacketDelimiter();
 };
 
-std::stringstream RevealWordServerbound::serialize() {
-  std::stringstream buffer;
-  buffer << RevealWordServerbound::ID << " ";
-  write_player_id(buffer, player_id);
-  buffer << std::endl;
-  return buffer;
+void RevealWordServerbound::serialize(UdpPacketWriter &writer) {
+  writer.write(RevealWordServerbound::ID);
+  writer.write(' ');
+  writer.writePlayerId(player_id);
+  writer.write('\n');
 };
 
-void RevealWordServerbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
+void RevealWordServerbound::deserialize(PacketReader &reader) {
   // Serverbound packets don't read their ID
-  readSpace(buffer);
-  player_id = readPlayerId(buffer);
-  readPacketDelimiter(buffer);
+  reader.readSpace();
+  player_id = reader.readPlayerId();
+  reader.readPacketDelimiter();
 };
 
-std::stringstream RevealWordClientbound::serialize() {
-  std::stringstream buffer;
-  buffer << RevealWordClientbound::ID << " " << word << std::endl;
-  return buffer;
+void RevealWordClientbound::serialize(UdpPacketWriter &writer) {
+  writer.write(RevealWordClientbound::ID);
+  writer.write(' ');
+  writer.write(word);
+  writer.write('\n');
 };
 
-void RevealWordClientbound::deserialize(std::stringstream &buffer) {
-  buffer >> std::noskipws;
-  readPacketId(buffer, RevealWordClientbound::ID);
-  readSpace(buffer);
-  word = readAlphabeticalString(buffer, WORD_MAX_LEN);
-  readPacketDelimiter(buffer);
+void RevealWordClientbound::deserialize(PacketReader &reader) {
+  reader.readPacketId(RevealWordClientbound::ID);
+  reader.readSpace();
+  word = reader.readAlphabeticalString(WORD_MAX_LEN);
+  reader.readPacketDelimiter();
 };
 
-std::stringstream ErrorUdpPacket::serialize() {
-  std::stringstream buffer;
-  buffer << ErrorUdpPacket::ID << std::endl;
-  return buffer;
+void ErrorUdpPacket::serialize(UdpPacketWriter &writer) {
+  writer.write(ErrorUdpPacket::ID);
+  writer.write('\n');
 };
 
-void ErrorUdpPacket::deserialize(std::stringstream &buffer) {
-  (void)buffer;
+void ErrorUdpPacket::deserialize(PacketReader &reader) {
+  (void)reader;
   // unimplemented
 };
 
-void TcpPacket::writeString(int fd, const std::string &str) {
+void TcpPacket::writeString(int fd, const std::string &str, bool more) {
   const char *buffer = str.c_str();
   ssize_t bytes_to_send = (ssize_t)str.length();
   ssize_t bytes_sent = 0;
   while (bytes_sent < bytes_to_send) {
-    ssize_t sent =
-        write(fd, buffer + bytes_sent, (size_t)(bytes_to_send - bytes_sent));
+    ssize_t sent = ::send(fd, buffer + bytes_sent,
+                          (size_t)(bytes_to_send - bytes_sent),
+                          more ? MSG_MORE : 0);
     if (sent < 0) {
       throw PacketSerializationException();
     }
@@ -447,63 +543,121 @@ void TcpPacket::writeString(int fd, const std::string &str) {
   }
 }
 
-void TcpPacket::readPacketId(int fd, const char *packet_id) {
-  char current_char;
-  while (*packet_id != '\0') {
-    if (read(fd, &current_char, 1) != 1 || current_char != *packet_id) {
-      throw UnexpectedPacketException();
-    }
-    ++packet_id;
+bool TcpStreamReader::fill() {
+  if (start < end) {
+    return true;
   }
+  ssize_t n = read(fd, buffer, TCP_READ_BUFFER_LEN);
+  if (n <= 0) {
+    return false;
+  }
+  start = 0;
+  end = (size_t)n;
+  return true;
 }
 
-void TcpPacket::readChar(int fd, char chr) {
-  if (readChar(fd) != chr) {
-    throw InvalidPacketException();
+bool TcpStreamReader::tryReadChar(char &c) {
+  if (!fill()) {
+    return false;
   }
+  c = buffer[start++];
+  return true;
 }
 
-char TcpPacket::readChar(int fd) {
-  char c = 0;
-  if (delimiter != 0) {
-    // use last read char instead, since it wasn't consumed yet
-    c = delimiter;
-    delimiter = 0;
-    return c;
-  }
-  if (read(fd, &c, 1) != 1) {
+char TcpStreamReader::readChar() {
+  char c;
+  if (!tryReadChar(c)) {
     throw InvalidPacketException();
   }
   return c;
 }
 
-void TcpPacket::readSpace(int fd) {
-  readChar(fd, ' ');
+char TcpStreamReader::peekChar() {
+  if (!fill()) {
+    throw InvalidPacketException();
+  }
+  return buffer[start];
 }
 
-void TcpPacket::readPacketDelimiter(int fd) {
-  readChar(fd, '\n');
+size_t TcpStreamReader::readBuffered(char *out, size_t max_len) {
+  size_t len = std::min(max_len, end - start);
+  memcpy(out, buffer + start, len);
+  start += len;
+  return len;
 }
 
-std::string TcpPacket::readString(const int fd) {
-  std::string result;
-  char c = 0;
+void TcpPacket::writeSegments(int fd, std::string_view *segments,
+                              size_t count) {
+  std::vector<struct iovec> iov(count);
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    iov[i].iov_base = (void *)segments[i].data();
+    iov[i].iov_len = segments[i].length();
+    total += segments[i].length();
+  }
 
-  while (!std::iswspace((wint_t)c)) {
-    if (read(fd, &c, 1) != 1) {
-      throw InvalidPacketException();
+  size_t first = 0;
+  while (total > 0) {
+    ssize_t sent = writev(fd, iov.data() + first, (int)(count - first));
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw PacketSerializationException();
+    }
+    total -= (size_t)sent;
+    // Skip what was written, which might end in the middle of a segment
+    size_t remaining = (size_t)sent;
+    while (first < count && remaining >= iov[first].iov_len) {
+      remaining -= iov[first].iov_len;
+      ++first;
+    }
+    if (first < count) {
+      iov[first].iov_base = (char *)iov[first].iov_base + remaining;
+      iov[first].iov_len -= remaining;
+    }
+  }
+}
+
+void TcpPacket::readPacketId(TcpStreamReader &reader, const char *packet_id) {
+  char current_char;
+  while (*packet_id != '\0') {
+    if (!reader.tryReadChar(current_char) || current_char != *packet_id) {
+      throw UnexpectedPacketException();
     }
-    result += c;
+    ++packet_id;
+  }
+}
+
+void TcpPacket::readChar(TcpStreamReader &reader, char chr) {
+  if (readChar(reader) != chr) {
+    throw InvalidPacketException();
   }
-  delimiter = c;
+}
 
-  result.pop_back();
+char TcpPacket::readChar(TcpStreamReader &reader) {
+  return reader.readChar();
+}
+
+void TcpPacket::readSpace(TcpStreamReader &reader) {
+  readChar(reader, ' ');
+}
+
+void TcpPacket::readPacketDelimiter(TcpStreamReader &reader) {
+  readChar(reader, '\n');
+}
 
+std::string TcpPacket::readString(TcpStreamReader &reader) {
+  std::string result;
+  // The delimiter is not consumed, since it is part of what comes next
+  while (!std::iswspace((wint_t)reader.peekChar())) {
+    result += reader.readChar();
+  }
   return result;
 }
 
-uint32_t TcpPacket::readInt(const int fd) {
-  std::string int_str = readString(fd);
+uint32_t TcpPacket::readInt(TcpStreamReader &reader) {
+  std::string int_str = readString(reader);
   try {
     size_t converted = 0;
     int64_t result = std::stoll(int_str, &converted, 10);
@@ -519,14 +673,35 @@ uint32_t TcpPacket::readInt(const int fd) {
   }
 }
 
-uint32_t TcpPacket::readPlayerId(const int fd) {
-  std::string id_str = readString(fd);
+uint32_t TcpPacket::readPlayerId(TcpStreamReader &reader) {
+  std::string id_str = readString(reader);
   return parse_packet_player_id(id_str);
 }
 
-void TcpPacket::readAndSaveToFile(const int fd, const std::string &file_name,
+void TcpPacket::saveChunk(std::ofstream &file, const char *buffer,
+                          const ssize_t n, const size_t file_size,
+                          size_t &remaining_size) {
+  file.write(buffer, n);
+  if (!file.good()) {
+    file.close();
+    throw IOException();
+  }
+  remaining_size -= (size_t)n;
+
+  size_t downloaded_size = file_size - remaining_size;
+  if (((downloaded_size - (size_t)n) * 100 / file_size) %
+          PROGRESS_BAR_STEP_SIZE >
+      (downloaded_size * 100 / file_size) % PROGRESS_BAR_STEP_SIZE) {
+    std::cout << "Progress: " << downloaded_size * 100 / file_size << "%"
+              << std::endl;
+  }
+}
+
+void TcpPacket::readAndSaveToFile(TcpStreamReader &reader,
+                                  const std::string &file_name,
                                   const size_t file_size,
                                   const bool cancellable) {
+  int fd = reader.getFd();
   std::ofstream file(file_name);
 
   if (!file.good()) {
@@ -545,6 +720,14 @@ void TcpPacket::readAndSaveToFile(const int fd, const std::string &file_name,
 
   bool skip_stdin = false;
   while (remaining_size > 0) {
+    to_read = std::min(remaining_size, (size_t)FILE_BUFFER_LEN);
+    if (reader.getBufferedLength() > 0) {
+      // The start of the file was read ahead along with the packet's header
+      n = (ssize_t)reader.readBuffered(buffer, to_read);
+      saveChunk(file, buffer, n, file_size, remaining_size);
+      continue;
+    }
+
     fd_set file_descriptors;
     FD_ZERO(&file_descriptors);
     FD_SET(fd, &file_descriptors);
@@ -568,26 +751,12 @@ void TcpPacket::readAndSaveToFile(const int fd, const std::string &file_name,
       throw ConnectionTimeoutException();
     } else if (FD_ISSET(fd, &file_descriptors)) {
       // Read from socket
-      to_read = std::min(remaining_size, (size_t)FILE_BUFFER_LEN);
       n = read(fd, buffer, to_read);
       if (n <= 0) {
         file.close();
         throw InvalidPacketException();
       }
-      file.write(buffer, n);
-      if (!file.good()) {
-        file.close();
-        throw IOException();
-      }
-      remaining_size -= (size_t)n;
-
-      size_t downloaded_size = file_size - remaining_size;
-      if (((downloaded_size - (size_t)n) * 100 / file_size) %
-              PROGRESS_BAR_STEP_SIZE >
-          (downloaded_size * 100 / file_size) % PROGRESS_BAR_STEP_SIZE) {
-        std::cout << "Progress: " << downloaded_size * 100 / file_size << "%"
-                  << std::endl;
-      }
+      saveChunk(file, buffer, n, file_size, remaining_size);
     } else if (FD_ISSET(fileno(stdin), &file_descriptors)) {
       if (std::cin.peek() != '\n') {
         skip_stdin = true;
@@ -610,45 +779,68 @@ void ScoreboardServerbound::send(int fd) {
   writeString(fd, stream.str());
 }
 
-void ScoreboardServerbound::receive(int fd) {
+void ScoreboardServerbound::receive(TcpStreamReader &reader) {
   // Serverbound packets don't read their ID
-  readPacketDelimiter(fd);
+  readPacketDelimiter(reader);
+}
+
+void ScoreboardServerbound::deserialize(PacketReader &reader) {
+  // Serverbound packets don't read their ID
+  reader.readPacketDelimiter();
 }
 
 void ScoreboardClientbound::send(int fd) {
+  std::string header;
+  serializeHeader(header);
+  if (status == OK) {
+    std::string_view segments[] = {header, file_data, "\n"};
+    writeSegments(fd, segments, std::size(segments));
+  } else {
+    writeString(fd, header);
+  }
+}
+
+void ScoreboardClientbound::serialize(std::string &out) {
+  serializeHeader(out);
+  if (status == OK) {
+    out.append(file_data);
+    out.push_back('\n');
+  }
+}
+
+void ScoreboardClientbound::serializeHeader(std::string &out) {
   std::stringstream stream;
   stream << ScoreboardClientbound::ID << " ";
 
   if (status == OK) {
     stream << "OK ";
-    stream << file_name << " " << file_data.length() << " " << file_data;
+    stream << file_name << " " << file_data.length() << " ";
   } else if (status == EMPTY) {
-    stream << "EMPTY";
+    stream << "EMPTY" << std::endl;
   } else {
     throw PacketSerializationException();
   }
-  stream << std::endl;
-  writeString(fd, stream.str());
+  out.append(stream.str());
 }
 
-void ScoreboardClientbound::receive(int fd) {
-  readPacketId(fd, ScoreboardClientbound::ID);
-  readSpace(fd);
-  auto status_str = readString(fd);
+void ScoreboardClientbound::receive(TcpStreamReader &reader) {
+  readPacketId(reader, ScoreboardClientbound::ID);
+  readSpace(reader);
+  auto status_str = readString(reader);
   if (status_str == "OK") {
     this->status = OK;
-    readSpace(fd);
-    file_name = readString(fd);
-    readSpace(fd);
-    uint32_t file_size = readInt(fd);
-    readSpace(fd);
-    readAndSaveToFile(fd, file_name, file_size, false);
+    readSpace(reader);
+    file_name = readString(reader);
+    readSpace(reader);
+    uint32_t file_size = readInt(reader);
+    readSpace(reader);
+    readAndSaveToFile(reader, file_name, file_size, false);
   } else if (status_str == "EMPTY") {
     this->status = EMPTY;
   } else {
     throw InvalidPacketException();
   }
-  readPacketDelimiter(fd);
+  readPacketDelimiter(reader);
 }
 
 void StateServerbound::send(int fd) {
@@ -659,56 +851,81 @@ void StateServerbound::send(int fd) {
   writeString(fd, stream.str());
 }
 
-void StateServerbound::receive(int fd) {
+void StateServerbound::receive(TcpStreamReader &reader) {
   // Serverbound packets don't read their ID
-  readSpace(fd);
-  player_id = readPlayerId(fd);
+  readSpace(reader);
+  player_id = readPlayerId(reader);
   if (player_id > PLAYER_ID_MAX) {
     throw InvalidPacketException();
   }
-  readPacketDelimiter(fd);
+  readPacketDelimiter(reader);
+}
+
+void StateServerbound::deserialize(PacketReader &reader) {
+  // Serverbound packets don't read their ID
+  reader.readSpace();
+  player_id = reader.readPlayerId();
+  reader.readPacketDelimiter();
 }
 
 void StateClientbound::send(int fd) {
+  std::string header;
+  serializeHeader(header);
+  if (status != NOK) {
+    std::string_view segments[] = {header, file_data, "\n"};
+    writeSegments(fd, segments, std::size(segments));
+  } else {
+    writeString(fd, header);
+  }
+}
+
+void StateClientbound::serialize(std::string &out) {
+  serializeHeader(out);
+  if (status != NOK) {
+    out.append(file_data);
+    out.push_back('\n');
+  }
+}
+
+void StateClientbound::serializeHeader(std::string &out) {
   std::stringstream stream;
   stream << StateClientbound::ID << " ";
   if (status == ACT) {
     stream << "ACT ";
-    stream << file_name << " " << file_data.length() << " " << file_data;
+    stream << file_name << " " << file_data.length() << " ";
   } else if (status == FIN) {
     stream << "FIN ";
-    stream << file_name << " " << file_data.length() << " " << file_data;
+    stream << file_name << " " << file_data.length() << " ";
   } else if (status == NOK) {
-    stream << "NOK";
+    stream << "NOK" << std::endl;
   } else {
     throw PacketSerializationException();
   }
-  stream << std::endl;
-  writeString(fd, stream.str());
+  out.append(stream.str());
 }
 
-void StateClientbound::receive(int fd) {
-  readPacketId(fd, StateClientbound::ID);
-  readSpace(fd);
-  auto status_str = readString(fd);
+void StateClientbound::receive(TcpStreamReader &reader) {
+  readPacketId(reader, StateClientbound::ID);
+  readSpace(reader);
+  auto status_str = readString(reader);
   if (status_str == "ACT") {
     this->status = ACT;
   } else if (status_str == "FIN") {
     this->status = FIN;
   } else if (status_str == "NOK") {
     this->status = NOK;
-    readPacketDelimiter(fd);
+    readPacketDelimiter(reader);
     return;
   } else {
     throw InvalidPacketException();
   }
-  readSpace(fd);
-  file_name = readString(fd);
-  readSpace(fd);
-  uint32_t file_size = readInt(fd);
-  readSpace(fd);
-  readAndSaveToFile(fd, file_name, file_size, false);
-  readPacketDelimiter(fd);
+  readSpace(reader);
+  file_name = readString(reader);
+  readSpace(reader);
+  uint32_t file_size = readInt(reader);
+  readSpace(reader);
+  readAndSaveToFile(reader, file_name, file_size, false);
+  readPacketDelimiter(reader);
 }
 
 void HintServerbound::send(int fd) {
@@ -719,71 +936,93 @@ void HintServerbound::send(int fd) {
   writeString(fd, stream.str());
 }
 
-void HintServerbound::receive(int fd) {
+void HintServerbound::receive(TcpStreamReader &reader) {
   // Serverbound packets don't read their ID
-  readSpace(fd);
-  player_id = readPlayerId(fd);
+  readSpace(reader);
+  player_id = readPlayerId(reader);
   if (player_id > PLAYER_ID_MAX) {
     throw InvalidPacketException();
   }
-  readPacketDelimiter(fd);
+  readPacketDelimiter(reader);
+}
+
+void HintServerbound::deserialize(PacketReader &reader) {
+  // Serverbound packets don't read their ID
+  reader.readSpace();
+  player_id = reader.readPlayerId();
+  reader.readPacketDelimiter();
 }
 
 void HintClientbound::send(int fd) {
+  std::string data;
+  if (status == OK) {
+    file_size = getFileSize(file_path);
+  }
+  serializeHeader(data);
+  writeString(fd, data, status == OK);
+  if (status == OK) {
+    sendFile(fd, file_path);
+    writeString(fd, "\n");
+  }
+}
+
+void HintClientbound::serializeHeader(std::string &out) {
   std::stringstream stream;
   stream << HintClientbound::ID << " ";
   if (status == OK) {
     stream << "OK ";
-    stream << file_name << " " << getFileSize(file_path) << " ";
-    writeString(fd, stream.str());
-    stream.str(std::string());
-    stream.clear();
-    sendFile(fd, file_path);
+    stream << file_name << " " << file_size << " ";
   } else if (status == NOK) {
-    stream << "NOK";
+    stream << "NOK" << std::endl;
   } else {
     throw PacketSerializationException();
   }
-  stream << std::endl;
-  writeString(fd, stream.str());
+  out.append(stream.str());
 }
 
-void HintClientbound::receive(int fd) {
-  readPacketId(fd, HintClientbound::ID);
-  readSpace(fd);
-  auto status_str = readString(fd);
+void HintClientbound::receive(TcpStreamReader &reader) {
+  readPacketId(reader, HintClientbound::ID);
+  readSpace(reader);
+  auto status_str = readString(reader);
   if (status_str == "OK") {
     this->status = OK;
-    readSpace(fd);
-    file_name = readString(fd);
-    readSpace(fd);
-    uint32_t file_size = readInt(fd);
-    readSpace(fd);
-    readAndSaveToFile(fd, file_name, file_size, true);
+    readSpace(reader);
+    file_name = readString(reader);
+    readSpace(reader);
+    file_size = readInt(reader);
+    readSpace(reader);
+    readAndSaveToFile(reader, file_name, file_size, true);
   } else if (status_str == "NOK") {
     this->status = NOK;
   } else {
     throw InvalidPacketException();
   }
-  readPacketDelimiter(fd);
+  readPacketDelimiter(reader);
 }
 
 void ErrorTcpPacket::send(int fd) {
-  writeString(fd, ErrorTcpPacket::ID);
-  writeString(fd, "\n");
+  std::string data;
+  serialize(data);
+  writeString(fd, data);
+}
+
+void ErrorTcpPacket::serialize(std::string &out) {
+  out.append(ErrorTcpPacket::ID);
+  out.push_back('\n');
 }
 
-void ErrorTcpPacket::receive(int fd) {
-  (void)fd;
+void ErrorTcpPacket::receive(TcpStreamReader &reader) {
+  (void)reader;
   // unimplemented
 }
 
 // Packet sending and receiving
 void send_packet(UdpPacket &packet, int socket, struct sockaddr *address,
                  socklen_t addrlen) {
-  const std::stringstream buffer = packet.serialize();
-  ssize_t n = sendto(socket, buffer.str().c_str(), buffer.str().length(), 0,
-                     address, addrlen);
+  char buffer[SOCKET_BUFFER_LEN];
+  UdpPacketWriter writer(buffer, SOCKET_BUFFER_LEN);
+  packet.serialize(writer);
+  ssize_t n = sendto(socket, buffer, writer.getLength(), 0, address, addrlen);
   if (n == -1) {
     throw UnrecoverableError("Failed to send UDP packet", errno);
   }
@@ -808,7 +1047,6 @@ void wait_for_packet(UdpPacket &packet, int socket) {
     throw ConnectionTimeoutException();
   }
 
-  std::stringstream data;
   char buffer[SOCKET_BUFFER_LEN];
 
   ssize_t n = recvfrom(socket, buffer, SOCKET_BUFFER_LEN, 0, NULL, NULL);
@@ -817,9 +1055,8 @@ void wait_for_packet(UdpPacket &packet, int socket) {
                              errno);
   }
 
-  data.write(buffer, n);
-
-  packet.deserialize(data);
+  PacketReader reader(buffer, (size_t)n);
+  packet.deserialize(reader);
 }
 
 void write_player_id(std::stringstream &buffer, const uint32_t player_id) {
@@ -827,37 +1064,29 @@ void write_player_id(std::stringstream &buffer, const uint32_t player_id) {
   buffer.copyfmt(std::ios(NULL));  // reset formatting
 }
 
-uint32_t parse_packet_player_id(std::string &id_str) {
+uint32_t parse_packet_player_id(std::string_view id_str) {
   if (id_str.length() != 6) {
     throw InvalidPacketException();
   }
+  uint32_t i = 0;
   for (char c : id_str) {
     if (!isdigit(c)) {
       throw InvalidPacketException();
     }
+    i = i * 10 + (uint32_t)(c - '0');
   }
-  try {
-    int i = std::stoi(id_str);
-    if (i < 0 || i > (int)PLAYER_ID_MAX) {
-      throw InvalidPacketException();
-    }
-    return (uint32_t)i;
-  } catch (...) {
+  if (i > PLAYER_ID_MAX) {
     throw InvalidPacketException();
   }
+  return i;
 }
 
-void sendFile(int connection_fd, std::filesystem::path file_path) {
-  std::ifstream file(file_path, std::ios::in | std::ios::binary);
-  if (!file) {
-    std::cerr << "Error opening file: " << file_path << std::endl;
-    throw PacketSerializationException();
-  }
-
+// Copies the file through a userspace buffer, for file systems that don't
+// support sendfile
+static void copyFile(int connection_fd, int file_fd) {
   char buffer[FILE_BUFFER_LEN];
-  while (file) {
-    file.read(buffer, FILE_BUFFER_LEN);
-    ssize_t bytes_read = (ssize_t)file.gcount();
+  ssize_t bytes_read;
+  while ((bytes_read = read(file_fd, buffer, FILE_BUFFER_LEN)) > 0) {
     ssize_t bytes_sent = 0;
     while (bytes_sent < bytes_read) {
       ssize_t sent = write(connection_fd, buffer + bytes_sent,
@@ -868,6 +1097,45 @@ void sendFile(int connection_fd, std::filesystem::path file_path) {
       bytes_sent += sent;
     }
   }
+  if (bytes_read < 0) {
+    throw PacketSerializationException();
+  }
+}
+
+void sendFile(int connection_fd, std::filesystem::path file_path) {
+  int file_fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat file_stat;
+  if (file_fd == -1 || fstat(file_fd, &file_stat) == -1) {
+    std::cerr << "Error opening file: " << file_path << std::endl;
+    if (file_fd != -1) {
+      close(file_fd);
+    }
+    throw PacketSerializationException();
+  }
+
+  try {
+    // The kernel copies the file straight into the socket
+    size_t file_size = (size_t)file_stat.st_size;
+    off_t offset = 0;
+    while ((size_t)offset < file_size) {
+      ssize_t n = sendfile(connection_fd, file_fd, &offset,
+                           file_size - (size_t)offset);
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n == -1 && (errno == EINVAL || errno == ENOSYS) && offset == 0) {
+        copyFile(connection_fd, file_fd);
+        break;
+      }
+      if (n <= 0) {
+        throw PacketSerializationException();
+      }
+    }
+  } catch (...) {
+    close(file_fd);
+    throw;
+  }
+  close(file_fd);
 }
 
 uint32_t getFileSize(std::filesystem::path file_path) {
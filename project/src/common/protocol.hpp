@@ -5,10 +5,12 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <fstream>
 #include <memory>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
+#include <string_view>
 #include <vector>
 
 #include "constants.hpp"
@@ -67,25 +69,80 @@ class OperationCancelledException : public std::runtime_error {
       : std::runtime_error("Operation cancelled by user") {}
 };
 
-class UdpPacket {
- private:
-  void readChar(std::stringstream &buffer, char chr);
+// Packs a PACKET_ID_LEN (3) letter packet ID into a 24-bit integer, so IDs
+// can be compared and switched on without building strings. Since it is
+// constexpr, the codes of the packet classes' IDs are known at compile time.
+constexpr uint32_t packet_id_code(const char *id) {
+  return ((uint32_t)(unsigned char)id[0] << 16) |
+         ((uint32_t)(unsigned char)id[1] << 8) | (uint32_t)(unsigned char)id[2];
+}
+
+// Cursor over a received packet, either a UDP datagram or a TCP request read
+// in full, parsing it in place.
+// Strings are returned as views into the packet buffer, so no copies or heap
+// allocations are made while deserializing a packet.
+class PacketReader {
+  char *data;
+  size_t length;
+  size_t position = 0;
+
+  void readChar(char chr);
 
- protected:
-  void readPacketId(std::stringstream &buffer, const char *id);
-  void readSpace(std::stringstream &buffer);
-  char readChar(std::stringstream &buffer);
-  char readAlphabeticalChar(std::stringstream &buffer);
-  void readPacketDelimiter(std::stringstream &buffer);
-  std::string readString(std::stringstream &buffer, uint32_t max_len);
-  std::string readAlphabeticalString(std::stringstream &buffer,
-                                     uint32_t max_len);
-  uint32_t readInt(std::stringstream &buffer);
-  uint32_t readPlayerId(std::stringstream &buffer);
+ public:
+  PacketReader(char *__data, size_t __length)
+      : data{__data}, length{__length} {};
+
+  uint32_t readAnyPacketId();
+  void readPacketId(const char *id);
+  void readSpace();
+  char readChar();
+  char readAlphabeticalChar();
+  void readPacketDelimiter();
+  std::string_view readString(uint32_t max_len);
+  std::string_view readAlphabeticalString(uint32_t max_len);
+  uint32_t readInt();
+  uint32_t readPlayerId();
+  std::string_view getPacket() {
+    return std::string_view(data, length);
+  }
+};
+
+// Writes a UDP packet into a caller-provided buffer, such as a stack buffer of
+// SOCKET_BUFFER_LEN bytes, without any heap allocations
+class UdpPacketWriter {
+  char *data;
+  size_t capacity;
+  size_t length = 0;
+
+ public:
+  UdpPacketWriter(char *__data, size_t __capacity)
+      : data{__data}, capacity{__capacity} {};
+
+  void write(char c);
+  void write(std::string_view str);
+  void writeInt(uint32_t i);
+  void writePlayerId(uint32_t player_id);
+  size_t getLength();
+};
+
+// Positions (starting at 1) of a letter in a word, stored inline since a word
+// has at most WORD_MAX_LEN letters
+class LetterPositions {
+  uint32_t positions[WORD_MAX_LEN];
+  uint32_t count = 0;
 
  public:
-  virtual std::stringstream serialize() = 0;
-  virtual void deserialize(std::stringstream &buffer) = 0;
+  void push_back(uint32_t position);
+  void clear();
+  uint32_t size() const;
+  const uint32_t *begin() const;
+  const uint32_t *end() const;
+};
+
+class UdpPacket {
+ public:
+  virtual void serialize(UdpPacketWriter &writer) = 0;
+  virtual void deserialize(PacketReader &reader) = 0;
 
   virtual ~UdpPacket() = default;
 };
@@ -96,8 +153,8 @@ class StartGameServerbound : public UdpPacket {
   static constexpr const char *ID = "SNG";
   uint32_t player_id;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 // Reply to Start Game Packet (RSG)
@@ -109,8 +166,8 @@ class ReplyStartGameClientbound : public UdpPacket {
   uint32_t n_letters;
   uint32_t max_errors;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 class GuessLetterServerbound : public UdpPacket {
@@ -120,8 +177,8 @@ class GuessLetterServerbound : public UdpPacket {
   char guess;
   uint32_t trial;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 class GuessLetterClientbound : public UdpPacket {
@@ -130,21 +187,22 @@ class GuessLetterClientbound : public UdpPacket {
   static constexpr const char *ID = "RLG";
   status status;
   uint32_t trial;
-  std::vector<uint32_t> pos;
+  LetterPositions pos;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 class GuessWordServerbound : public UdpPacket {
  public:
   static constexpr const char *ID = "PWG";
   uint32_t player_id;
-  std::string guess;
+  // When deserialized, points into the packet buffer
+  std::string_view guess;
   uint32_t trial;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 class GuessWordClientbound : public UdpPacket {
@@ -154,8 +212,8 @@ class GuessWordClientbound : public UdpPacket {
   status status;
   uint32_t trial;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 class QuitGameServerbound : public UdpPacket {
@@ -163,8 +221,8 @@ class QuitGameServerbound : public UdpPacket {
   static constexpr const char *ID = "QUT";
   uint32_t player_id;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 class QuitGameClientbound : public UdpPacket {
@@ -173,8 +231,8 @@ class QuitGameClientbound : public UdpPacket {
   static constexpr const char *ID = "RQT";
   status status;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 class RevealWordServerbound : public UdpPacket {
@@ -182,8 +240,8 @@ class RevealWordServerbound : public UdpPacket {
   static constexpr const char *ID = "REV";
   uint32_t player_id;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 class RevealWordClientbound : public UdpPacket {
@@ -191,39 +249,74 @@ class RevealWordClientbound : public UdpPacket {
   static constexpr const char *ID = "RRV";
   std::string word;
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
 };
 
 class ErrorUdpPacket : public UdpPacket {
  public:
   static constexpr const char *ID = "ERR";
 
-  std::stringstream serialize();
-  void deserialize(std::stringstream &buffer);
+  void serialize(UdpPacketWriter &writer);
+  void deserialize(PacketReader &reader);
+};
+
+// Buffered reader over a TCP connection, so packets are parsed from memory
+// filled by as few read() calls as possible, instead of one call per byte.
+// It may read past the end of a packet, so it must live as long as the
+// connection it reads from.
+class TcpStreamReader {
+  int fd;
+  char buffer[TCP_READ_BUFFER_LEN];
+  size_t start = 0;
+  size_t end = 0;
+
+  bool fill();
+
+ public:
+  explicit TcpStreamReader(int __fd) : fd{__fd} {};
+
+  int getFd() {
+    return fd;
+  }
+  // Returns false if the connection was closed or failed
+  bool tryReadChar(char &c);
+  char readChar();
+  // Returns the next char without consuming it
+  char peekChar();
+  // Number of bytes that were read ahead and not consumed yet
+  size_t getBufferedLength() {
+    return end - start;
+  }
+  // Consumes up to max_len of the bytes that were read ahead
+  size_t readBuffered(char *out, size_t max_len);
 };
 
 class TcpPacket {
  private:
-  char delimiter = 0;
-
-  void readChar(int fd, char chr);
+  void readChar(TcpStreamReader &reader, char chr);
+  void saveChunk(std::ofstream &file, const char *buffer, const ssize_t n,
+                 const size_t file_size, size_t &remaining_size);
 
  protected:
-  void writeString(int fd, const std::string &str);
-  void readPacketId(int fd, const char *id);
-  void readSpace(int fd);
-  char readChar(int fd);
-  void readPacketDelimiter(int fd);
-  std::string readString(const int fd);
-  uint32_t readInt(const int fd);
-  uint32_t readPlayerId(const int fd);
-  void readAndSaveToFile(const int fd, const std::string &file_name,
+  // With more, the kernel is told that more data follows
+  void writeString(int fd, const std::string &str, bool more = false);
+  // Writes all segments in order with writev, without joining them first
+  void writeSegments(int fd, std::string_view *segments, size_t count);
+  void readPacketId(TcpStreamReader &reader, const char *id);
+  void readSpace(TcpStreamReader &reader);
+  char readChar(TcpStreamReader &reader);
+  void readPacketDelimiter(TcpStreamReader &reader);
+  // Reads until a whitespace char, which is left to be read next
+  std::string readString(TcpStreamReader &reader);
+  uint32_t readInt(TcpStreamReader &reader);
+  uint32_t readPlayerId(TcpStreamReader &reader);
+  void readAndSaveToFile(TcpStreamReader &reader, const std::string &file_name,
                          const size_t file_size, const bool cancellable);
 
  public:
   virtual void send(int fd) = 0;
-  virtual void receive(int fd) = 0;
+  virtual void receive(TcpStreamReader &reader) = 0;
 
   virtual ~TcpPacket() = default;
 };
@@ -233,7 +326,8 @@ class ScoreboardServerbound : public TcpPacket {
   static constexpr const char *ID = "GSB";
 
   void send(int fd);
-  void receive(int fd);
+  void receive(TcpStreamReader &reader);
+  void deserialize(PacketReader &reader);
 };
 
 class ScoreboardClientbound : public TcpPacket {
@@ -245,7 +339,11 @@ class ScoreboardClientbound : public TcpPacket {
   std::string file_data;
 
   void send(int fd);
-  void receive(int fd);
+  void receive(TcpStreamReader &reader);
+  void serialize(std::string &out);
+  // Everything up to the file data, which must be followed by the packet
+  // delimiter. If the status is not OK, that is the whole packet.
+  void serializeHeader(std::string &out);
 };
 
 class HintServerbound : public TcpPacket {
@@ -254,7 +352,8 @@ class HintServerbound : public TcpPacket {
   uint32_t player_id;
 
   void send(int fd);
-  void receive(int fd);
+  void receive(TcpStreamReader &reader);
+  void deserialize(PacketReader &reader);
 };
 
 class StateServerbound : public TcpPacket {
@@ -263,7 +362,8 @@ class StateServerbound : public TcpPacket {
   uint32_t player_id;
 
   void send(int fd);
-  void receive(int fd);
+  void receive(TcpStreamReader &reader);
+  void deserialize(PacketReader &reader);
 };
 
 class StateClientbound : public TcpPacket {
@@ -275,7 +375,11 @@ class StateClientbound : public TcpPacket {
   std::string file_data;
 
   void send(int fd);
-  void receive(int fd);
+  void receive(TcpStreamReader &reader);
+  void serialize(std::string &out);
+  // Everything up to the file data, which must be followed by the packet
+  // delimiter. If the status is NOK, that is the whole packet.
+  void serializeHeader(std::string &out);
 };
 
 class HintClientbound : public TcpPacket {
@@ -285,9 +389,13 @@ class HintClientbound : public TcpPacket {
   status status;
   std::filesystem::path file_path;
   std::string file_name;
+  uint32_t file_size = 0;
 
   void send(int fd);
-  void receive(int fd);
+  void receive(TcpStreamReader &reader);
+  // Everything up to the file contents, which must be followed by the packet
+  // delimiter. If the status is not OK, that is the whole packet.
+  void serializeHeader(std::string &out);
 };
 
 class ErrorTcpPacket : public TcpPacket {
@@ -295,7 +403,8 @@ class ErrorTcpPacket : public TcpPacket {
   static constexpr const char *ID = "ERR";
 
   void send(int fd);
-  void receive(int fd);
+  void receive(TcpStreamReader &reader);
+  void serialize(std::string &out);
 };
 
 void send_packet(UdpPacket &packet, int socket, struct sockaddr *address,
@@ -305,7 +414,7 @@ void wait_for_packet(UdpPacket &packet, int socket);
 
 void write_player_id(std::stringstream &buffer, const uint32_t player_id);
 
-uint32_t parse_packet_player_id(std::string &id_str);
+uint32_t parse_packet_player_id(std::string_view id_str);
 
 void sendFile(int connection_fd, std::filesystem::path image_path);
 
@@ -0,0 +1,98 @@
+#include "event_loop.hpp"
+
+#include <unistd.h>
+
+#include "common/common.hpp"
+#include "common/constants.hpp"
+
+extern int shutdown_event_fd;
+
+EventLoop::EventLoop(bool __stop_on_shutdown)
+    : stop_on_shutdown{__stop_on_shutdown} {
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    throw UnrecoverableError("Failed to create epoll instance", errno);
+  }
+
+  if (stop_on_shutdown && shutdown_event_fd != -1) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = shutdown_event_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, shutdown_event_fd, &event) == -1) {
+      close(epoll_fd);
+      throw UnrecoverableError("Failed to watch shutdown event", errno);
+    }
+  }
+}
+
+EventLoop::~EventLoop() {
+  if (epoll_fd != -1) {
+    close(epoll_fd);
+  }
+}
+
+void EventLoop::add(int fd, uint32_t events, EventHandler handler) {
+  struct epoll_event event;
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    throw UnrecoverableError("Failed to add file descriptor to epoll", errno);
+  }
+  handlers[fd] = std::make_shared<EventHandler>(handler);
+}
+
+void EventLoop::modify(int fd, uint32_t events) {
+  struct epoll_event event;
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1) {
+    throw UnrecoverableError("Failed to modify file descriptor in epoll",
+                             errno);
+  }
+}
+
+void EventLoop::remove(int fd) {
+  if (handlers.erase(fd) == 0) {
+    return;
+  }
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+void EventLoop::run() {
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+  while (!shouldStop()) {
+    int n = epoll_wait(epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw UnrecoverableError("Failed to wait for events (epoll_wait)",
+                               errno);
+    }
+
+    for (int i = 0; i < n && !shouldStop(); ++i) {
+      int fd = events[i].data.fd;
+      if (fd == shutdown_event_fd) {
+        // The event is never consumed, so it wakes up every other loop too
+        return;
+      }
+      // Handlers might remove file descriptors whose events are still pending
+      // in this iteration, so they must be looked up every time
+      auto it = handlers.find(fd);
+      if (it != handlers.end()) {
+        // Keep the handler alive even if it removes itself while running
+        std::shared_ptr<EventHandler> handler = it->second;
+        (*handler)(events[i].events);
+      }
+    }
+  }
+}
+
+void EventLoop::stop() {
+  stopped = true;
+}
+
+bool EventLoop::shouldStop() {
+  return stopped || (stop_on_shutdown && is_shutting_down);
+}
@@ -0,0 +1,37 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <sys/epoll.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+typedef std::function<void(uint32_t events)> EventHandler;
+
+// Reactor that waits on a set of file descriptors with epoll and dispatches
+// their events to the registered handlers.
+// Unless told otherwise, loops also wait on the shutdown event, so run()
+// returns as soon as a shutdown is requested, without waking up periodically
+// while idle.
+class EventLoop {
+  int epoll_fd = -1;
+  bool stop_on_shutdown;
+  bool stopped = false;
+  std::unordered_map<int, std::shared_ptr<EventHandler>> handlers;
+
+  bool shouldStop();
+
+ public:
+  explicit EventLoop(bool __stop_on_shutdown = true);
+  ~EventLoop();
+  void add(int fd, uint32_t events, EventHandler handler);
+  void modify(int fd, uint32_t events);
+  void remove(int fd);
+  void run();
+  // Makes run() return, must be called from one of the handlers
+  void stop();
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "game_table.hpp"
+
+#include "logger.hpp"
+
+// Fibonacci hashing, spreading consecutive player IDs over all shards
+#define HASH_MULTIPLIER (0x9E3779B97F4A7C15ULL)
+
+std::shared_ptr<ServerGame> GameTableShard::find(uint32_t player_id) {
+  ++lookups;
+  auto it = index.find(player_id);
+  if (it == index.end()) {
+    return NULL;
+  }
+  entries.splice(entries.begin(), entries, it->second);
+  return it->second->second;
+}
+
+void GameTableShard::insert(uint32_t player_id,
+                            std::shared_ptr<ServerGame> game) {
+  erase(player_id);
+  entries.emplace_front(player_id, game);
+  index[player_id] = entries.begin();
+  evict();
+}
+
+void GameTableShard::erase(uint32_t player_id) {
+  auto it = index.find(player_id);
+  if (it != index.end()) {
+    entries.erase(it->second);
+    index.erase(it);
+  }
+}
+
+void GameTableShard::eraseGame(uint32_t player_id,
+                               const std::shared_ptr<ServerGame>& game) {
+  auto it = index.find(player_id);
+  if (it != index.end() && it->second->second == game) {
+    entries.erase(it->second);
+    index.erase(it);
+  }
+}
+
+size_t GameTableShard::size() {
+  return entries.size();
+}
+
+void GameTableShard::evict() {
+  auto candidate = entries.end();
+  size_t probes = 0;
+  while (entries.size() > max_games && candidate != entries.begin() &&
+         probes < GAME_TABLE_EVICTION_PROBES) {
+    --candidate;
+    ++probes;
+    // A game still held by a request is not dropped, or it could be loaded
+    // again while that request is changing it. Since games are only handed
+    // out with the lock held, no one else can start using it meanwhile.
+    if (candidate->second.use_count() > 1) {
+      continue;
+    }
+    index.erase(candidate->first);
+    candidate = entries.erase(candidate);
+    ++evictions;
+  }
+}
+
+GameTable::GameTable(uint32_t max_games) {
+  // Spread the limit over the shards, rounding up
+  size_t max_shard_games =
+      ((size_t)max_games + GAME_TABLE_SHARDS - 1) / GAME_TABLE_SHARDS;
+  for (GameTableShard& shard : shards) {
+    shard.max_games = max_shard_games;
+  }
+}
+
+GameTableShard& GameTable::shardFor(uint32_t player_id) {
+  size_t index = (size_t)((player_id * HASH_MULTIPLIER) >> 32) &
+                 (GAME_TABLE_SHARDS - 1);
+  return shards[index];
+}
+
+void GameTable::logStats(double uptime_seconds) {
+  size_t resident = 0;
+  uint64_t lookups = 0;
+  uint64_t loads = 0;
+  uint64_t evictions = 0;
+  for (GameTableShard& shard : shards) {
+    std::scoped_lock<std::mutex> slock(shard.lock);
+    resident += shard.size();
+    lookups += shard.lookups;
+    loads += shard.loads;
+    evictions += shard.evictions;
+  }
+  double loads_per_second =
+      uptime_seconds > 0 ? (double)loads / uptime_seconds : 0;
+  logger.info(
+      "[Games] {} game(s) in memory, {} evicted, {} loaded from disk in {} "
+      "lookup(s), {} per second",
+      resident, evictions, loads, lookups, loads_per_second);
+}
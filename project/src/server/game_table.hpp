@@ -0,0 +1,59 @@
+#ifndef GAME_TABLE_H
+#define GAME_TABLE_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "common/constants.hpp"
+#include "server_game.hpp"
+
+// Part of the game table, with its own lock, map and least recently used
+// order. Shards are kept on separate cache lines, so threads locking different
+// shards don't slow each other down. It is not synchronized by itself, it must
+// only be accessed with its lock held.
+class alignas(64) GameTableShard {
+  typedef std::list<std::pair<uint32_t, std::shared_ptr<ServerGame>>>
+      EntryList;
+
+  EntryList entries;  // most recently used first
+  std::unordered_map<uint32_t, EntryList::iterator> index;
+
+  // Drops the least recently used games no one is using, until the shard is
+  // back under max_games
+  void evict();
+
+ public:
+  std::mutex lock;
+  size_t max_games = 1;
+  uint64_t lookups = 0;
+  uint64_t loads = 0;
+  uint64_t evictions = 0;
+
+  // Returns NULL if the game is not in memory
+  std::shared_ptr<ServerGame> find(uint32_t player_id);
+  void insert(uint32_t player_id, std::shared_ptr<ServerGame> game);
+  void erase(uint32_t player_id);
+  // Erases the game kept for player_id, only if it is still the given one
+  void eraseGame(uint32_t player_id, const std::shared_ptr<ServerGame>& game);
+  size_t size();
+};
+
+// Games by player ID, split into GAME_TABLE_SHARDS independently locked
+// shards, so requests from different players rarely wait for each other, and
+// a map growing only rehashes the games of its own shard.
+// At most max_games are kept in memory. Every change to a game is saved to
+// its file right away, so the least recently used ones can be dropped at any
+// time, to be loaded again from their file when needed.
+class GameTable {
+  GameTableShard shards[GAME_TABLE_SHARDS];
+
+ public:
+  explicit GameTable(uint32_t max_games);
+  GameTableShard& shardFor(uint32_t player_id);
+  void logStats(double uptime_seconds);
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "hint_cache.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common/protocol.hpp"
+
+static bool same_mtime(const struct timespec& a, const struct timespec& b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool same_version(const CachedHint& hint, const struct stat& file_stat) {
+  return same_mtime(hint.mtime, file_stat.st_mtim) &&
+         hint.size == file_stat.st_size && hint.inode == file_stat.st_ino;
+}
+
+std::shared_ptr<CachedHint> HintCache::get(const std::filesystem::path& path,
+                                           const std::string& file_name) {
+  // A single stat both checks the file exists and validates the cached entry
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) == -1 || !S_ISREG(file_stat.st_mode) ||
+      file_stat.st_size > HINT_CACHE_MAX_FILE_SIZE) {
+    return NULL;
+  }
+
+  std::string key = path.string();
+  {
+    std::scoped_lock<std::mutex> slock(lock);
+    auto it = index.find(key);
+    if (it != index.end()) {
+      std::shared_ptr<CachedHint> hint = it->second->second;
+      if (same_version(*hint, file_stat)) {
+        ++hits;
+        entries.splice(entries.begin(), entries, it->second);
+        return hint;
+      }
+      entries.erase(it->second);
+      index.erase(it);
+    }
+    ++misses;
+  }
+
+  // The file is read without the lock, so a slow read never holds up the
+  // requests for other hints
+  std::shared_ptr<CachedHint> hint = load(path, file_name, file_stat);
+  if (hint == NULL) {
+    return NULL;
+  }
+
+  std::scoped_lock<std::mutex> slock(lock);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    // Another request loaded the file in the meantime
+    if (same_version(*it->second->second, file_stat)) {
+      entries.splice(entries.begin(), entries, it->second);
+      return it->second->second;
+    }
+    entries.erase(it->second);
+    index.erase(it);
+  }
+  entries.emplace_front(key, hint);
+  index[key] = entries.begin();
+  if (entries.size() > HINT_CACHE_SIZE) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+  return hint;
+}
+
+std::shared_ptr<CachedHint> HintCache::load(const std::filesystem::path& path,
+                                            const std::string& file_name,
+                                            struct stat& file_stat) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return NULL;
+  }
+  // Use the stat of the opened file, in case it was replaced in the meantime
+  if (fstat(fd, &file_stat) == -1 ||
+      file_stat.st_size > HINT_CACHE_MAX_FILE_SIZE) {
+    close(fd);
+    return NULL;
+  }
+
+  std::shared_ptr<CachedHint> hint = std::make_shared<CachedHint>();
+  hint->mtime = file_stat.st_mtim;
+  hint->size = file_stat.st_size;
+  hint->inode = file_stat.st_ino;
+  hint->contents.resize((size_t)file_stat.st_size);
+  size_t loaded = 0;
+  while (loaded < hint->contents.length()) {
+    ssize_t n = pread(fd, hint->contents.data() + loaded,
+                      hint->contents.length() - loaded, (off_t)loaded);
+    if (n <= 0) {
+      // The file was truncated while reading it
+      close(fd);
+      return NULL;
+    }
+    loaded += (size_t)n;
+  }
+  close(fd);
+
+  HintClientbound packet;
+  packet.status = HintClientbound::status::OK;
+  packet.file_name = file_name;
+  packet.file_size = (uint32_t)hint->size;
+  packet.serializeHeader(hint->header);
+  return hint;
+}
@@ -0,0 +1,51 @@
+#ifndef HINT_CACHE_H
+#define HINT_CACHE_H
+
+#include <sys/stat.h>
+
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "common/constants.hpp"
+
+// Contents of a hint file, together with the RHL response header announcing
+// it, so a hint can be sent straight from memory
+class CachedHint {
+ public:
+  std::string header;
+  std::string contents;
+  struct timespec mtime;
+  off_t size;
+  ino_t inode;
+};
+
+// Least recently used hint files, up to HINT_CACHE_SIZE of them. An entry is
+// reloaded when the file's modification time, size or inode change, so hints
+// can be replaced while the server is running. Entries are shared with the
+// responses still sending them, so evicting one never invalidates a response.
+class HintCache {
+  typedef std::list<std::pair<std::string, std::shared_ptr<CachedHint>>>
+      EntryList;
+
+  EntryList entries;  // most recently used first
+  std::unordered_map<std::string, EntryList::iterator> index;
+  std::mutex lock;
+
+  std::shared_ptr<CachedHint> load(const std::filesystem::path& path,
+                                   const std::string& file_name,
+                                   struct stat& file_stat);
+
+ public:
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  // Returns NULL if the file does not exist or is too large to be cached
+  std::shared_ptr<CachedHint> get(const std::filesystem::path& path,
+                                  const std::string& file_name);
+};
+
+#endif
@@ -0,0 +1,374 @@
+#include "logger.hpp"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+Logger logger;
+
+#define NANOSECONDS_PER_SECOND (1000000000ULL)
+
+class LogRingOwner {
+ public:
+  LogRing* ring = NULL;
+
+  ~LogRingOwner() {
+    // The logger thread frees the ring after draining what is left in it
+    if (ring != NULL) {
+      ring->retired.store(true, std::memory_order_release);
+    }
+  }
+};
+
+static thread_local LogRingOwner thread_ring;
+
+static const char* level_name(LogLevel level) {
+  switch (level) {
+    case LOG_DEBUG:
+      return "DEBUG";
+    case LOG_INFO:
+      return "INFO";
+    case LOG_WARNING:
+      return "WARNING";
+    case LOG_ERROR:
+      return "ERROR";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+static uint64_t now_nanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+template <class T>
+static void append_number(std::string& out, T value) {
+  char buffer[24];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  out.append(buffer, (size_t)(result.ptr - buffer));
+}
+
+static void append_argument(LogRecord& record, LogArgument& arg,
+                            std::string& out) {
+  char buffer[32];
+  switch (arg.type) {
+    case LogArgument::UINT:
+      append_number(out, arg.uint_value);
+      break;
+    case LogArgument::INT:
+      append_number(out, arg.int_value);
+      break;
+    case LogArgument::CHAR:
+      out.push_back(arg.char_value);
+      break;
+    case LogArgument::DOUBLE:
+      snprintf(buffer, sizeof(buffer), "%g", arg.double_value);
+      out.append(buffer);
+      break;
+    case LogArgument::TEXT:
+      out.append(record.text + arg.text.offset, arg.text.length);
+      break;
+    case LogArgument::ADDRESS:
+      inet_ntop(AF_INET, &arg.address.sin_addr, buffer, sizeof(buffer));
+      out.append(buffer);
+      out.push_back(':');
+      append_number(out, ntohs(arg.address.sin_port));
+      break;
+    case LogArgument::PLAYER:
+      snprintf(buffer, sizeof(buffer), "[Player %0*u] ", PLAYER_ID_MAX_LEN,
+               (uint32_t)arg.uint_value);
+      out.append(buffer);
+      break;
+    default:
+      break;
+  }
+}
+
+void LogRecord::pushText(std::string_view value) {
+  LogArgument& arg = args[arg_count++];
+  size_t length =
+      std::min(value.length(), (size_t)(LOG_RECORD_TEXT_LEN - text_length));
+  memcpy(text + text_length, value.data(), length);
+
+  arg.type = LogArgument::TEXT;
+  arg.text.offset = (uint16_t)text_length;
+  arg.text.length = (uint16_t)length;
+  text_length += (uint32_t)length;
+}
+
+LogRecord* LogRing::reserve(uint64_t now) {
+  // Refill the token bucket according to the time since the last refill
+  uint64_t elapsed = now - last_refill;
+  if (elapsed >= NANOSECONDS_PER_SECOND) {
+    tokens = LOG_RATE_LIMIT_PER_SECOND;
+    last_refill = now;
+  } else {
+    uint64_t refill =
+        elapsed * LOG_RATE_LIMIT_PER_SECOND / NANOSECONDS_PER_SECOND;
+    if (refill > 0) {
+      tokens = std::min(tokens + refill, (uint64_t)LOG_RATE_LIMIT_PER_SECOND);
+      last_refill +=
+          refill * NANOSECONDS_PER_SECOND / LOG_RATE_LIMIT_PER_SECOND;
+    }
+  }
+
+  // Only this thread writes to the counters, so there is no need for an
+  // atomic read-modify-write
+  if (tokens == 0) {
+    dropped_rate_limited.store(
+        dropped_rate_limited.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    return NULL;
+  }
+
+  uint64_t h = head.load(std::memory_order_relaxed);
+  if (h - tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+    dropped_full.store(dropped_full.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+    return NULL;
+  }
+
+  --tokens;
+  return &records[h % LOG_RING_SIZE];
+}
+
+void LogRing::commit() {
+  head.store(head.load(std::memory_order_relaxed) + 1,
+             std::memory_order_release);
+}
+
+Logger::~Logger() {
+  stop();
+  for (LogRing* ring : rings) {
+    delete ring;
+  }
+}
+
+void Logger::setLevel(LogLevel level) {
+  min_level.store(level, std::memory_order_relaxed);
+}
+
+bool Logger::isEnabled(LogLevel level) {
+  return level >= min_level.load(std::memory_order_relaxed);
+}
+
+void Logger::start() {
+  std::scoped_lock<std::mutex> lock(writer_lock);
+  if (running) {
+    return;
+  }
+  running = true;
+  writer = std::thread(&Logger::writerLoop, this);
+}
+
+void Logger::stop() {
+  {
+    std::scoped_lock<std::mutex> lock(writer_lock);
+    if (!running) {
+      return;
+    }
+    running = false;
+  }
+  writer_cond.notify_all();
+  writer.join();
+
+  std::scoped_lock<std::mutex> lock(drain_lock);
+  drain();
+  reportDropped();
+
+  uint64_t dropped_full, dropped_rate_limited;
+  countDropped(dropped_full, dropped_rate_limited);
+  std::cout << "Logged " << written << " record(s), dropped "
+            << dropped_full + dropped_rate_limited << " (" << dropped_full
+            << " with full buffers, " << dropped_rate_limited
+            << " rate limited)" << std::endl;
+}
+
+LogRing* Logger::threadRing() {
+  if (thread_ring.ring == NULL) {
+    thread_ring.ring = new LogRing;
+    std::scoped_lock<std::mutex> lock(rings_lock);
+    rings.push_back(thread_ring.ring);
+  }
+  return thread_ring.ring;
+}
+
+LogRecord* Logger::reserve(LogLevel level) {
+  uint64_t now = now_nanoseconds();
+  LogRecord* record = threadRing()->reserve(now);
+  if (record != NULL) {
+    record->timestamp = now;
+    record->level = level;
+    record->arg_count = 0;
+    record->text_length = 0;
+  }
+  return record;
+}
+
+void Logger::commit() {
+  thread_ring.ring->commit();
+
+  if (!running.load(std::memory_order_acquire)) {
+    // There is no logger thread (yet or anymore), so write it right away
+    std::scoped_lock<std::mutex> lock(drain_lock);
+    drain();
+  }
+}
+
+void Logger::writerLoop() {
+  auto last_report = std::chrono::steady_clock::now();
+  while (running.load(std::memory_order_acquire)) {
+    size_t drained;
+    {
+      std::scoped_lock<std::mutex> lock(drain_lock);
+      drained = drain();
+
+      auto now = std::chrono::steady_clock::now();
+      if (now - last_report >=
+          std::chrono::seconds(LOG_DROPPED_REPORT_INTERVAL_SECONDS)) {
+        reportDropped();
+        last_report = now;
+      }
+    }
+
+    if (drained == 0) {
+      std::unique_lock<std::mutex> lock(writer_lock);
+      writer_cond.wait_for(
+          lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS),
+          [this] { return !running.load(std::memory_order_acquire); });
+    }
+  }
+}
+
+size_t Logger::drain() {
+  {
+    std::scoped_lock<std::mutex> lock(rings_lock);
+    draining = rings;
+  }
+
+  pending.clear();
+  draining_heads.clear();
+  for (LogRing* ring : draining) {
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    for (uint64_t i = tail; i < head; ++i) {
+      pending.push_back(&ring->records[i % LOG_RING_SIZE]);
+    }
+    draining_heads.push_back(head);
+  }
+
+  // Merge the records of all threads back into chronological order
+  std::stable_sort(pending.begin(), pending.end(),
+                   [](LogRecord* a, LogRecord* b) {
+                     return a->timestamp < b->timestamp;
+                   });
+  for (LogRecord* record : pending) {
+    format(*record, record->level >= LOG_WARNING ? err_buffer : out_buffer);
+  }
+  flush();
+
+  // Only hand the slots back to the producers after formatting them
+  for (size_t i = 0; i < draining.size(); ++i) {
+    draining[i]->tail.store(draining_heads[i], std::memory_order_release);
+  }
+  written += pending.size();
+
+  // Free the rings of threads that have exited, once they are empty
+  std::scoped_lock<std::mutex> lock(rings_lock);
+  for (auto it = rings.begin(); it != rings.end();) {
+    LogRing* ring = *it;
+    if (ring->retired.load(std::memory_order_acquire) &&
+        ring->head.load(std::memory_order_acquire) ==
+            ring->tail.load(std::memory_order_relaxed)) {
+      retired_dropped_full += ring->dropped_full.load();
+      retired_dropped_rate_limited += ring->dropped_rate_limited.load();
+      delete ring;
+      it = rings.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  return pending.size();
+}
+
+void Logger::format(LogRecord& record, std::string& out) {
+  time_t seconds = (time_t)(record.timestamp / NANOSECONDS_PER_SECOND);
+  uint32_t millis =
+      (uint32_t)(record.timestamp % NANOSECONDS_PER_SECOND / 1000000);
+  struct tm time;
+  localtime_r(&seconds, &time);
+
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "[%02d:%02d:%02d.%03u] [%s] ", time.tm_hour,
+           time.tm_min, time.tm_sec, millis, level_name(record.level));
+  out.append(prefix);
+
+  uint32_t next_arg = 0;
+  for (const char* c = record.format; *c != '\0'; ++c) {
+    if (c[0] == '{' && c[1] == '}' && next_arg < record.arg_count) {
+      append_argument(record, record.args[next_arg++], out);
+      ++c;
+    } else {
+      out.push_back(*c);
+    }
+  }
+  out.push_back('\n');
+}
+
+void Logger::flush() {
+  if (!out_buffer.empty()) {
+    std::cout.write(out_buffer.data(), (std::streamsize)out_buffer.size());
+    std::cout.flush();
+    out_buffer.clear();
+  }
+  if (!err_buffer.empty()) {
+    std::cerr.write(err_buffer.data(), (std::streamsize)err_buffer.size());
+    std::cerr.flush();
+    err_buffer.clear();
+  }
+}
+
+void Logger::countDropped(uint64_t& full, uint64_t& rate_limited) {
+  full = retired_dropped_full;
+  rate_limited = retired_dropped_rate_limited;
+  std::scoped_lock<std::mutex> lock(rings_lock);
+  for (LogRing* ring : rings) {
+    full += ring->dropped_full.load(std::memory_order_relaxed);
+    rate_limited += ring->dropped_rate_limited.load(std::memory_order_relaxed);
+  }
+}
+
+void Logger::reportDropped() {
+  uint64_t dropped_full, dropped_rate_limited;
+  countDropped(dropped_full, dropped_rate_limited);
+  if (dropped_full == reported_dropped_full &&
+      dropped_rate_limited == reported_dropped_rate_limited) {
+    return;
+  }
+
+  // Goes through the same formatting as any other record, but is never
+  // subject to the limits itself
+  LogRecord record;
+  record.timestamp = now_nanoseconds();
+  record.level = LOG_WARNING;
+  record.format =
+      "Dropped {} log record(s) with full buffers and {} rate limited log "
+      "record(s) since the last report";
+  record.arg_count = 0;
+  record.text_length = 0;
+  record.push(dropped_full - reported_dropped_full);
+  record.push(dropped_rate_limited - reported_dropped_rate_limited);
+  format(record, err_buffer);
+  flush();
+
+  reported_dropped_full = dropped_full;
+  reported_dropped_rate_limited = dropped_rate_limited;
+}
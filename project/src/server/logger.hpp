@@ -0,0 +1,197 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "common/constants.hpp"
+
+enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR };
+
+// Prints "[Player 000001] " in front of the message
+class playerTag {
+ public:
+  uint32_t player_id;
+  explicit playerTag(uint32_t __player_id) : player_id{__player_id} {}
+};
+
+class LogArgument {
+ public:
+  enum type { UINT, INT, CHAR, DOUBLE, TEXT, ADDRESS, PLAYER };
+  type type;
+  union {
+    uint64_t uint_value;
+    int64_t int_value;
+    char char_value;
+    double double_value;
+    struct {
+      uint16_t offset;
+      uint16_t length;
+    } text;
+    struct sockaddr_in address;
+  };
+};
+
+// A fixed-size, binary log record. The format string must be a string
+// literal, with a `{}` placeholder for each argument. Strings are copied into
+// the record (and truncated if they don't fit), everything else is stored
+// as is and only formatted by the logger thread.
+class LogRecord {
+ public:
+  uint64_t timestamp;  // nanoseconds since epoch
+  LogLevel level;
+  const char* format;
+  uint32_t arg_count;
+  uint32_t text_length;
+  LogArgument args[LOG_RECORD_ARGS_MAX];
+  char text[LOG_RECORD_TEXT_LEN];
+
+  void pushText(std::string_view value);
+  template <class T>
+  void push(const T& value);
+};
+
+// Single producer, single consumer ring of records. The producer is the
+// thread that owns it, the consumer is the logger thread.
+class LogRing {
+ public:
+  LogRecord records[LOG_RING_SIZE];
+  alignas(64) std::atomic<uint64_t> head{0};  // next slot to write
+  alignas(64) std::atomic<uint64_t> tail{0};  // next slot to read
+  alignas(64) std::atomic<uint64_t> dropped_full{0};
+  std::atomic<uint64_t> dropped_rate_limited{0};
+  std::atomic<bool> retired{false};
+
+  // Token bucket, only touched by the producer
+  uint64_t tokens = LOG_RATE_LIMIT_PER_SECOND;
+  uint64_t last_refill = 0;
+
+  LogRecord* reserve(uint64_t now);
+  void commit();
+};
+
+class Logger {
+  std::atomic<int> min_level{LOG_INFO};
+  std::atomic<bool> running{false};
+  std::thread writer;
+  std::mutex writer_lock;
+  std::condition_variable writer_cond;
+
+  std::mutex rings_lock;
+  std::vector<LogRing*> rings;
+
+  // Only touched while holding drain_lock
+  std::mutex drain_lock;
+  std::vector<LogRing*> draining;
+  std::vector<uint64_t> draining_heads;
+  std::vector<LogRecord*> pending;
+  std::string out_buffer;
+  std::string err_buffer;
+  uint64_t written = 0;
+  uint64_t retired_dropped_full = 0;
+  uint64_t retired_dropped_rate_limited = 0;
+  uint64_t reported_dropped_full = 0;
+  uint64_t reported_dropped_rate_limited = 0;
+
+  LogRing* threadRing();
+  LogRecord* reserve(LogLevel level);
+  void commit();
+  void writerLoop();
+  size_t drain();
+  void format(LogRecord& record, std::string& out);
+  void flush();
+  void countDropped(uint64_t& full, uint64_t& rate_limited);
+  void reportDropped();
+
+ public:
+  ~Logger();
+  void setLevel(LogLevel level);
+  bool isEnabled(LogLevel level);
+  void start();
+  void stop();
+
+  template <class... Args>
+  void log(LogLevel level, const char* format, const Args&... args) {
+    static_assert(sizeof...(Args) <= LOG_RECORD_ARGS_MAX,
+                  "Too many arguments for a log record");
+    if (!isEnabled(level)) {
+      return;
+    }
+    LogRecord* record = reserve(level);
+    if (record == NULL) {
+      return;
+    }
+    record->format = format;
+    (record->push(args), ...);
+    commit();
+  }
+
+  template <class... Args>
+  void debug(const char* format, const Args&... args) {
+    log(LOG_DEBUG, format, args...);
+  }
+
+  template <class... Args>
+  void info(const char* format, const Args&... args) {
+    log(LOG_INFO, format, args...);
+  }
+
+  template <class... Args>
+  void warning(const char* format, const Args&... args) {
+    log(LOG_WARNING, format, args...);
+  }
+
+  template <class... Args>
+  void error(const char* format, const Args&... args) {
+    log(LOG_ERROR, format, args...);
+  }
+};
+
+extern Logger logger;
+
+template <class T>
+void LogRecord::push(const T& value) {
+  if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+    pushText(value);
+  } else if constexpr (std::is_same_v<T, std::filesystem::path>) {
+    pushText(value.native());
+  } else {
+    LogArgument& arg = args[arg_count++];
+    if constexpr (std::is_same_v<T, char>) {
+      arg.type = LogArgument::CHAR;
+      arg.char_value = value;
+    } else if constexpr (std::is_same_v<T, bool>) {
+      arg.type = LogArgument::CHAR;
+      arg.char_value = value ? 'Y' : 'N';
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+      arg.type = LogArgument::INT;
+      arg.int_value = value;
+    } else if constexpr (std::is_integral_v<T>) {
+      arg.type = LogArgument::UINT;
+      arg.uint_value = value;
+    } else if constexpr (std::is_floating_point_v<T>) {
+      arg.type = LogArgument::DOUBLE;
+      arg.double_value = value;
+    } else if constexpr (std::is_same_v<T, struct sockaddr_in>) {
+      arg.type = LogArgument::ADDRESS;
+      arg.address = value;
+    } else if constexpr (std::is_same_v<T, playerTag>) {
+      arg.type = LogArgument::PLAYER;
+      arg.uint_value = value.player_id;
+    } else {
+      static_assert(!sizeof(T), "Unsupported log argument type");
+    }
+  }
+}
+
+#endif
@@ -2,19 +2,18 @@
 
 #include <fstream>
 #include <iomanip>
-#include <iostream>
 
 #include "common/protocol.hpp"
+#include "udp_batch.hpp"
 
-void handle_start_game(std::stringstream &buffer, Address &addr_from,
+void handle_start_game(PacketReader &reader, Address &addr_from,
                        GameServerState &state) {
   StartGameServerbound packet;
   ReplyStartGameClientbound response;
 
   try {
-    packet.deserialize(buffer);
-    state.cdebug << playerTag(packet.player_id) << "Asked to start game"
-                 << std::endl;
+    packet.deserialize(reader);
+    logger.debug("{}Asked to start game", playerTag(packet.player_id));
 
     ServerGameSync game = state.createGame(packet.player_id);
 
@@ -24,39 +23,46 @@ void handle_start_game(std::stringstream &buffer, Address &addr_from,
 
     game->saveToFile();
 
-    state.cdebug << playerTag(packet.player_id) << "Game started with word '"
-                 << game->getWord() << "' and with " << game->getMaxErrors()
-                 << " errors allowed" << std::endl;
+    logger.debug("{}Game started with word '{}' and with {} errors allowed",
+                 playerTag(packet.player_id), game->getWord(),
+                 game->getMaxErrors());
   } catch (GameAlreadyStartedException &e) {
-    state.cdebug << playerTag(packet.player_id) << "Game already started"
-                 << std::endl;
+    logger.debug("{}Game already started", playerTag(packet.player_id));
     response.status = ReplyStartGameClientbound::NOK;
   } catch (InvalidPacketException &e) {
-    state.cdebug << "[Start Game] Invalid packet received" << std::endl;
+    logger.debug("[Start Game] Invalid packet received");
     response.status = ReplyStartGameClientbound::ERR;
   } catch (std::exception &e) {
-    std::cerr << "[Start Game] There was an unhandled exception that prevented "
-                 "the server from starting a new game:"
-              << e.what() << std::endl;
+    logger.error(
+        "[Start Game] There was an unhandled exception that prevented the "
+        "server from starting a new game: {}", e.what());
     return;
   }
 
-  send_packet(response, addr_from.socket, (struct sockaddr *)&addr_from.addr,
-              addr_from.size);
+  send_udp_reply(response, addr_from);
 }
 
-void handle_guess_letter(std::stringstream &buffer, Address &addr_from,
+void handle_guess_letter(PacketReader &reader, Address &addr_from,
                          GameServerState &state) {
   GuessLetterServerbound packet;
   GuessLetterClientbound response;
   try {
-    packet.deserialize(buffer);
+    packet.deserialize(reader);
 
-    state.cdebug << playerTag(packet.player_id) << "Guessed letter '"
-                 << packet.guess << "'" << std::endl;
+    logger.debug("{}Guessed letter '{}'", playerTag(packet.player_id),
+                 packet.guess);
 
     ServerGameSync game = state.getGame(packet.player_id);
 
+    // Retransmission of the last guess, answer exactly as before
+    auto cached_reply = game->getCachedReply(packet.trial, reader.getPacket());
+    if (cached_reply.has_value()) {
+      logger.debug("{}Replaying reply to trial {}", playerTag(packet.player_id),
+                   packet.trial);
+      send_udp_reply(cached_reply.value(), addr_from);
+      return;
+    }
+
     response.trial = game->getCurrentTrial();
     auto found = game->guessLetter(packet.guess, packet.trial);
     // Must set trial again in case of replays
@@ -66,66 +72,78 @@ void handle_guess_letter(std::stringstream &buffer, Address &addr_from,
 
     if (game->hasLost()) {
       response.status = GuessLetterClientbound::status::OVR;
-      state.cdebug << playerTag(packet.player_id) << "Game lost" << std::endl;
+      logger.debug("{}Game lost", playerTag(packet.player_id));
     } else if (found.size() == 0) {
       response.status = GuessLetterClientbound::status::NOK;
-      state.cdebug << playerTag(packet.player_id) << "Wrong letter '"
-                   << packet.guess << "'" << std::endl;
+      logger.debug("{}Wrong letter '{}'", playerTag(packet.player_id),
+                   packet.guess);
     } else if (game->hasWon()) {
       response.status = GuessLetterClientbound::status::WIN;
       state.scoreboard.addGame(game.game);
-      state.cdebug << playerTag(packet.player_id) << "Won the game. Word was '"
-                   << game->getWord() << "'" << std::endl;
+      logger.debug("{}Won the game. Word was '{}'", playerTag(packet.player_id),
+                   game->getWord());
     } else {
       response.status = GuessLetterClientbound::status::OK;
-      state.cdebug << playerTag(packet.player_id) << "Correct letter '"
-                   << packet.guess << "'. Trial " << response.trial
-                   << ". Progress: " << game->getWordProgress() << std::endl;
+      logger.debug("{}Correct letter '{}'. Trial {}. Progress: {}",
+                   playerTag(packet.player_id), packet.guess, response.trial,
+                   game->getWordProgress());
     }
     response.pos = found;
+
+    send_udp_reply(
+        game->cacheReply(packet.trial, reader.getPacket(), response),
+        addr_from);
+    return;
   } catch (NoGameFoundException &e) {
     response.status = GuessLetterClientbound::status::ERR;
-    state.cdebug << playerTag(packet.player_id) << "No game found" << std::endl;
+    logger.debug("{}No game found", playerTag(packet.player_id));
   } catch (DuplicateLetterGuessException &e) {
     response.status = GuessLetterClientbound::status::DUP;
     response.trial -= 1;
-    state.cdebug << playerTag(packet.player_id) << "Guessed duplicate letter '"
-                 << packet.guess << "'" << std::endl;
+    logger.debug("{}Guessed duplicate letter '{}'", playerTag(packet.player_id),
+                 packet.guess);
   } catch (InvalidTrialException &e) {
     response.status = GuessLetterClientbound::status::INV;
     response.trial -= 1;
-    state.cdebug << playerTag(packet.player_id) << "Invalid trial "
-                 << packet.trial << std::endl;
+    logger.debug("{}Invalid trial {}", playerTag(packet.player_id),
+                 packet.trial);
   } catch (GameHasEndedException &e) {
     response.status = GuessLetterClientbound::status::ERR;
-    state.cdebug << playerTag(packet.player_id) << "Game has ended"
-                 << std::endl;
+    logger.debug("{}Game has ended", playerTag(packet.player_id));
   } catch (InvalidPacketException &e) {
     response.status = GuessLetterClientbound::status::ERR;
-    state.cdebug << "[Guess Letter] Invalid packet received" << std::endl;
+    logger.debug("[Guess Letter] Invalid packet received");
   } catch (std::exception &e) {
-    std::cerr << "[Guess Letter] There was an unhandled exception that "
-                 "prevented the server from handling a letter guess:"
-              << e.what() << std::endl;
+    logger.error(
+        "[Guess Letter] There was an unhandled exception that prevented the "
+        "server from handling a letter guess: {}", e.what());
     return;
   }
 
-  send_packet(response, addr_from.socket, (struct sockaddr *)&addr_from.addr,
-              addr_from.size);
+  send_udp_reply(response, addr_from);
 }
 
-void handle_guess_word(std::stringstream &buffer, Address &addr_from,
+void handle_guess_word(PacketReader &reader, Address &addr_from,
                        GameServerState &state) {
   GuessWordServerbound packet;
   GuessWordClientbound response;
   try {
-    packet.deserialize(buffer);
+    packet.deserialize(reader);
 
-    state.cdebug << playerTag(packet.player_id) << "Guessed word '"
-                 << packet.guess << "'" << std::endl;
+    logger.debug("{}Guessed word '{}'", playerTag(packet.player_id),
+                 packet.guess);
 
     ServerGameSync game = state.getGame(packet.player_id);
 
+    // Retransmission of the last guess, answer exactly as before
+    auto cached_reply = game->getCachedReply(packet.trial, reader.getPacket());
+    if (cached_reply.has_value()) {
+      logger.debug("{}Replaying reply to trial {}", playerTag(packet.player_id),
+                   packet.trial);
+      send_udp_reply(cached_reply.value(), addr_from);
+      return;
+    }
+
     response.trial = game->getCurrentTrial();
     bool correct = game->guessWord(packet.guess, packet.trial);
     // Must set trial again in case of replays
@@ -135,248 +153,268 @@ void handle_guess_word(std::stringstream &buffer, Address &addr_from,
 
     if (game->hasLost()) {
       response.status = GuessWordClientbound::status::OVR;
-      state.cdebug << playerTag(packet.player_id) << "Game lost" << std::endl;
+      logger.debug("{}Game lost", playerTag(packet.player_id));
     } else if (correct) {
       response.status = GuessWordClientbound::status::WIN;
       state.scoreboard.addGame(game.game);
-      state.cdebug << playerTag(packet.player_id) << "Guess was correct"
-                   << std::endl;
+      logger.debug("{}Guess was correct", playerTag(packet.player_id));
     } else {
       response.status = GuessWordClientbound::status::NOK;
-      state.cdebug << playerTag(packet.player_id) << "Guess was wrong. Trial "
-                   << response.trial << " Progress: " << game->getWordProgress()
-                   << std::endl;
+      logger.debug("{}Guess was wrong. Trial {} Progress: {}",
+                   playerTag(packet.player_id), response.trial,
+                   game->getWordProgress());
     }
+
+    send_udp_reply(
+        game->cacheReply(packet.trial, reader.getPacket(), response),
+        addr_from);
+    return;
   } catch (NoGameFoundException &e) {
     response.status = GuessWordClientbound::status::ERR;
-    state.cdebug << playerTag(packet.player_id) << "No game found" << std::endl;
+    logger.debug("{}No game found", playerTag(packet.player_id));
   } catch (DuplicateWordGuessException &e) {
     response.status = GuessWordClientbound::status::DUP;
     response.trial -= 1;
-    state.cdebug << playerTag(packet.player_id) << "Guessed duplicate word '"
-                 << packet.guess << "'" << std::endl;
+    logger.debug("{}Guessed duplicate word '{}'", playerTag(packet.player_id),
+                 packet.guess);
   } catch (InvalidTrialException &e) {
     response.status = GuessWordClientbound::status::INV;
     response.trial -= 1;
-    state.cdebug << playerTag(packet.player_id)
-                 << "Invalid trial sent. Trial sent: " << packet.trial
-                 << ". Correct trial: " << (response.trial + 1) << std::endl;
+    logger.debug("{}Invalid trial sent. Trial sent: {}. Correct trial: {}",
+                 playerTag(packet.player_id), packet.trial,
+                 (response.trial + 1));
   } catch (GameHasEndedException &e) {
     response.status = GuessWordClientbound::status::ERR;
-    state.cdebug << playerTag(packet.player_id) << "Game has ended"
-                 << std::endl;
+    logger.debug("{}Game has ended", playerTag(packet.player_id));
   } catch (InvalidPacketException &e) {
-    state.cdebug << "[Guess Word] Invalid packet" << std::endl;
+    logger.debug("[Guess Word] Invalid packet");
     response.status = GuessWordClientbound::status::ERR;
   } catch (std::exception &e) {
-    std::cerr << "[Guess Word] There was an unhandled exception that prevented "
-                 "the server from handling a word guess:"
-              << e.what() << std::endl;
+    logger.error(
+        "[Guess Word] There was an unhandled exception that prevented the "
+        "server from handling a word guess: {}", e.what());
     return;
   }
 
-  send_packet(response, addr_from.socket, (struct sockaddr *)&addr_from.addr,
-              addr_from.size);
+  send_udp_reply(response, addr_from);
 }
 
-void handle_quit_game(std::stringstream &buffer, Address &addr_from,
+void handle_quit_game(PacketReader &reader, Address &addr_from,
                       GameServerState &state) {
   QuitGameServerbound packet;
   QuitGameClientbound response;
   try {
-    packet.deserialize(buffer);
+    packet.deserialize(reader);
 
-    state.cdebug << playerTag(packet.player_id) << "Quitting game" << std::endl;
+    logger.debug("{}Quitting game", playerTag(packet.player_id));
 
     ServerGameSync game = state.getGame(packet.player_id);
 
     if (game->isOnGoing()) {
       game->finishGame();
+      game->clearCachedReply();
       response.status = QuitGameClientbound::status::OK;
-      state.cdebug << playerTag(packet.player_id) << "Fulfilling quit request"
-                   << std::endl;
+      logger.debug("{}Fulfilling quit request", playerTag(packet.player_id));
     } else {
       response.status = QuitGameClientbound::status::NOK;
-      state.cdebug << playerTag(packet.player_id) << "Game had already ended"
-                   << std::endl;
+      logger.debug("{}Game had already ended", playerTag(packet.player_id));
     }
 
     game->saveToFile();
 
   } catch (NoGameFoundException &e) {
     response.status = QuitGameClientbound::status::NOK;
-    state.cdebug << playerTag(packet.player_id) << "No game found" << std::endl;
+    logger.debug("{}No game found", playerTag(packet.player_id));
   } catch (InvalidPacketException &e) {
-    state.cdebug << "[Quit] Invalid packet" << std::endl;
+    logger.debug("[Quit] Invalid packet");
     response.status = QuitGameClientbound::status::ERR;
   } catch (std::exception &e) {
-    std::cerr << "[Quit] There was an unhandled exception that prevented the "
-                 "server from handling a quit game request:"
-              << e.what() << std::endl;
+    logger.error(
+        "[Quit] There was an unhandled exception that prevented the server "
+        "from handling a quit game request: {}", e.what());
     return;
   }
 
-  send_packet(response, addr_from.socket, (struct sockaddr *)&addr_from.addr,
-              addr_from.size);
+  send_udp_reply(response, addr_from);
 }
 
-void handle_reveal_word(std::stringstream &buffer, Address &addr_from,
+void handle_reveal_word(PacketReader &reader, Address &addr_from,
                         GameServerState &state) {
   RevealWordServerbound packet;
   RevealWordClientbound response;
   try {
-    packet.deserialize(buffer);
+    packet.deserialize(reader);
 
-    state.cdebug << playerTag(packet.player_id) << "Asked to reveal word"
-                 << std::endl;
+    logger.debug("{}Asked to reveal word", playerTag(packet.player_id));
 
     ServerGameSync game = state.getGame(packet.player_id);
 
-    state.cdebug << playerTag(packet.player_id) << "Word is " << game->getWord()
-                 << std::endl;
+    logger.debug("{}Word is {}", playerTag(packet.player_id), game->getWord());
 
     response.word = game->getWord();
   } catch (NoGameFoundException &e) {
     // The protocol says we should not reply if there is not an on-going game
-    state.cdebug << playerTag(packet.player_id) << "No game found" << std::endl;
+    logger.debug("{}No game found", playerTag(packet.player_id));
     return;
   } catch (InvalidPacketException &e) {
-    state.cdebug << "[Reveal] Invalid packet" << std::endl;
+    logger.debug("[Reveal] Invalid packet");
     // Propagate error to reply with "ERR", since there is no error code here
     throw;
   } catch (std::exception &e) {
-    std::cerr << "[Reveal] There was an unhandled exception that prevented the "
-                 "server from handling a word reveal:"
-              << e.what() << std::endl;
+    logger.error(
+        "[Reveal] There was an unhandled exception that prevented the server "
+        "from handling a word reveal: {}", e.what());
     return;
   }
 
-  send_packet(response, addr_from.socket, (struct sockaddr *)&addr_from.addr,
-              addr_from.size);
+  send_udp_reply(response, addr_from);
 }
 
-void handle_scoreboard(int connection_fd, GameServerState &state) {
+void handle_scoreboard(PacketReader &reader, TcpResponse &response,
+                       GameServerState &state) {
   ScoreboardServerbound packet;
-  ScoreboardClientbound response;
   try {
-    packet.receive(connection_fd);
+    packet.deserialize(reader);
 
-    state.cdebug << "[Scoreboard] Received request" << std::endl;
+    logger.debug("[Scoreboard] Received request");
 
-    auto scoreboard_str = state.scoreboard.toString();
-    if (scoreboard_str.has_value()) {
-      response.status = ScoreboardClientbound::status::OK;
-      response.file_name = "scoreboard.txt";
-      response.file_data = scoreboard_str.value();
-      state.cdebug << "[Scoreboard] Sending back scoreboard as per request"
-                   << std::endl;
+    // Already rendered when the scoreboard last changed
+    std::shared_ptr<const RenderedScoreboard> scoreboard =
+        state.scoreboard.getRendered();
+    if (!scoreboard->empty) {
+      logger.debug("[Scoreboard] Sending back scoreboard version {}",
+                   scoreboard->version);
     } else {
-      response.status = ScoreboardClientbound::status::EMPTY;
-      state.cdebug
-          << "[Scoreboard] There are no won games, sending empty scoreboard"
-          << std::endl;
+      logger.debug(
+          "[Scoreboard] There are no won games, sending empty scoreboard");
     }
+    response.attachShared(std::shared_ptr<const std::string>(
+        scoreboard, &scoreboard->response));
   } catch (InvalidPacketException &e) {
-    state.cdebug << "[Scoreboard] Invalid packet" << std::endl;
+    logger.debug("[Scoreboard] Invalid packet");
     // Propagate error to reply with "ERR", since there is no error code here
     throw;
   } catch (std::exception &e) {
-    std::cerr << "[Scoreboard] There was an unhandled exception that prevented "
-                 "the server from handling a scoreboard request:"
-              << e.what() << std::endl;
+    logger.error(
+        "[Scoreboard] There was an unhandled exception that prevented the "
+        "server from handling a scoreboard request: {}", e.what());
     return;
   }
-
-  response.send(connection_fd);
 }
 
-void handle_hint(int connection_fd, GameServerState &state) {
+void handle_hint(PacketReader &reader, TcpResponse &response,
+                 GameServerState &state) {
   HintServerbound packet;
-  HintClientbound response;
+  HintClientbound response_packet;
+  std::shared_ptr<CachedHint> hint;
   try {
-    packet.receive(connection_fd);
-
-    state.cdebug << playerTag(packet.player_id) << "Requested hint"
-                 << std::endl;
-
-    ServerGameSync game = state.getGame(packet.player_id);
+    packet.deserialize(reader);
+
+    logger.debug("{}Requested hint", playerTag(packet.player_id));
+
+    bool on_going;
+    std::optional<std::filesystem::path> hint_path;
+    std::string hint_file_name;
+    {
+      // The game is unlocked before the hint is read, so other requests for
+      // it don't wait on the disk
+      ServerGameSync game = state.getGame(packet.player_id);
+      on_going = game->isOnGoing();
+      hint_path = game->getHintFilePath();
+      hint_file_name = game->getHintFileName();
+    }
+    if (on_going && hint_path.has_value()) {
+      hint = state.hint_cache.get(hint_path.value(), hint_file_name);
+    }
 
-    if (!game->isOnGoing()) {
-      response.status = HintClientbound::status::NOK;
-      state.cdebug << playerTag(packet.player_id)
-                   << "Fulfilling hint request: game had already ended."
-                   << std::endl;
-    } else if (!game->getHintFilePath().has_value() ||
-               !std::filesystem::exists(game->getHintFilePath().value())) {
-      response.status = HintClientbound::status::NOK;
-      state.cdebug << playerTag(packet.player_id)
-                   << "Current game doesn't have a hint to send." << std::endl;
+    if (!on_going) {
+      response_packet.status = HintClientbound::status::NOK;
+      logger.debug("{}Fulfilling hint request: game had already ended.",
+                   playerTag(packet.player_id));
+    } else if (!hint_path.has_value() ||
+               (hint == NULL && !std::filesystem::exists(hint_path.value()))) {
+      response_packet.status = HintClientbound::status::NOK;
+      logger.debug("{}Current game doesn't have a hint to send.",
+                   playerTag(packet.player_id));
     } else {
-      response.status = HintClientbound::status::OK;
-      response.file_path = game->getHintFilePath().value();
-      response.file_name = game->getHintFileName();
-      state.cdebug << playerTag(packet.player_id)
-                   << "Fulfilling hint request: sending hint from file: "
-                   << game->getHintFilePath().value() << std::endl;
+      response_packet.status = HintClientbound::status::OK;
+      response_packet.file_path = hint_path.value();
+      response_packet.file_name = hint_file_name;
+      if (hint != NULL) {
+        response.attachHint(hint);
+      } else {
+        // Too large to be cached, so it is sent from the file
+        response_packet.file_size =
+            (uint32_t)response.attachFile(response_packet.file_path);
+      }
+      logger.debug("{}Fulfilling hint request: sending hint from file: {}",
+                   playerTag(packet.player_id), hint_path.value());
     }
   } catch (NoGameFoundException &e) {
-    response.status = HintClientbound::status::NOK;
-    state.cdebug << playerTag(packet.player_id) << "Game not found"
-                 << std::endl;
+    response_packet.status = HintClientbound::status::NOK;
+    logger.debug("{}Game not found", playerTag(packet.player_id));
   } catch (InvalidPacketException &e) {
-    response.status = HintClientbound::status::NOK;
-    state.cdebug << "[Hint] Invalid packet" << std::endl;
+    response_packet.status = HintClientbound::status::NOK;
+    logger.debug("[Hint] Invalid packet");
   } catch (std::exception &e) {
-    std::cerr << "[Hint] There was an unhandled exception that prevented the "
-                 "server from handling a hint request:"
-              << e.what() << std::endl;
+    logger.error(
+        "[Hint] There was an unhandled exception that prevented the server "
+        "from handling a hint request: {}", e.what());
     return;
   }
 
-  response.send(connection_fd);
+  if (hint == NULL) {
+    // Cached hints come with their header
+    response_packet.serializeHeader(response.data);
+  }
+  if (response_packet.status == HintClientbound::status::OK) {
+    // The file attached to the response goes in between
+    response.trailer = "\n";
+  }
 }
 
-void handle_state(int connection_fd, GameServerState &state) {
+void handle_state(PacketReader &reader, TcpResponse &response,
+                  GameServerState &state) {
   StateServerbound packet;
-  StateClientbound response;
+  StateClientbound response_packet;
   try {
-    packet.receive(connection_fd);
+    packet.deserialize(reader);
 
-    state.cdebug << playerTag(packet.player_id) << "Requested game state"
-                 << std::endl;
+    logger.debug("{}Requested game state", playerTag(packet.player_id));
 
     ServerGameSync game = state.getGame(packet.player_id);
 
     if (game->isOnGoing()) {
-      response.status = StateClientbound::status::ACT;
-      state.cdebug << playerTag(packet.player_id)
-                   << "Fulfilling state request: sending active game."
-                   << std::endl;
+      response_packet.status = StateClientbound::status::ACT;
+      logger.debug("{}Fulfilling state request: sending active game.",
+                   playerTag(packet.player_id));
     } else {
-      response.status = StateClientbound::status::FIN;
-      state.cdebug << playerTag(packet.player_id)
-                   << "Fulfilling state request: sending last finished game."
-                   << std::endl;
+      response_packet.status = StateClientbound::status::FIN;
+      logger.debug("{}Fulfilling state request: sending last finished game.",
+                   playerTag(packet.player_id));
     }
     std::stringstream file_name;
     file_name << "state_" << std::setfill('0') << std::setw(PLAYER_ID_MAX_LEN)
               << game->getPlayerId() << ".txt";
-    response.file_name = file_name.str();
-    response.file_data = game->getStateString();
+    response_packet.file_name = file_name.str();
+    response_packet.file_data = game->getStateString();
   } catch (NoGameFoundException &e) {
-    response.status = StateClientbound::status::NOK;
-    state.cdebug << playerTag(packet.player_id) << "Game not found"
-                 << std::endl;
+    response_packet.status = StateClientbound::status::NOK;
+    logger.debug("{}Game not found", playerTag(packet.player_id));
   } catch (InvalidPacketException &e) {
-    response.status = StateClientbound::status::NOK;
-    state.cdebug << "[State] Invalid packet" << std::endl;
+    response_packet.status = StateClientbound::status::NOK;
+    logger.debug("[State] Invalid packet");
   } catch (std::exception &e) {
-    std::cerr
-        << "[State] There was an unhandled exception that prevented the server "
-           "from handling a state request:"
-        << e.what() << std::endl;
+    logger.error(
+        "[State] There was an unhandled exception that prevented the server "
+        "from handling a state request: {}", e.what());
     return;
   }
 
-  response.send(connection_fd);
+  response_packet.serializeHeader(response.data);
+  if (response_packet.status != StateClientbound::status::NOK) {
+    // Written right after the header, without copying it into data
+    response.body = std::move(response_packet.file_data);
+    response.trailer = "\n";
+  }
 }
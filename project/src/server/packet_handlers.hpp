@@ -4,43 +4,37 @@
 #include <sstream>
 
 #include "common/constants.hpp"
+#include "common/protocol.hpp"
+#include "logger.hpp"
 #include "server_state.hpp"
-
-class playerTag {  // IOManip helper
-  uint32_t player_id;
-
- public:
-  explicit playerTag(uint32_t __player_id) : player_id{__player_id} {}
-  friend std::ostream &operator<<(std::ostream &os, const playerTag &obj) {
-    os << "[Player " << std::setfill('0') << std::setw(PLAYER_ID_MAX_LEN)
-       << obj.player_id << "] ";
-    return os;
-  }
-};
+#include "tcp_connection.hpp"
 
 // UDP
 
-void handle_start_game(std::stringstream &buffer, Address &addr_from,
+void handle_start_game(PacketReader &reader, Address &addr_from,
                        GameServerState &state);
 
-void handle_guess_letter(std::stringstream &buffer, Address &addr_from,
+void handle_guess_letter(PacketReader &reader, Address &addr_from,
                          GameServerState &state);
 
-void handle_guess_word(std::stringstream &buffer, Address &addr_from,
+void handle_guess_word(PacketReader &reader, Address &addr_from,
                        GameServerState &state);
 
-void handle_quit_game(std::stringstream &buffer, Address &addr_from,
+void handle_quit_game(PacketReader &reader, Address &addr_from,
                       GameServerState &state);
 
-void handle_reveal_word(std::stringstream &buffer, Address &addr_from,
+void handle_reveal_word(PacketReader &reader, Address &addr_from,
                         GameServerState &state);
 
 // TCP
 
-void handle_scoreboard(int connection_fd, GameServerState &state);
+void handle_scoreboard(PacketReader &reader, TcpResponse &response,
+                       GameServerState &state);
 
-void handle_hint(int connection_fd, GameServerState &state);
+void handle_hint(PacketReader &reader, TcpResponse &response,
+                 GameServerState &state);
 
-void handle_state(int connection_fd, GameServerState &state);
+void handle_state(PacketReader &reader, TcpResponse &response,
+                  GameServerState &state);
 
 #endif
@@ -0,0 +1,128 @@
+#include "rate_limiter.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+
+#define NANOSECONDS_PER_SECOND (1000000000ULL)
+
+// Keys of both kinds share the same table, so they are tagged to never collide
+#define SOURCE_KEY_TAG (1ULL << 32)
+#define PLAYER_KEY_TAG (2ULL << 32)
+
+// Fibonacci hashing, spreading consecutive keys over the whole table
+#define HASH_MULTIPLIER (0x9E3779B97F4A7C15ULL)
+
+static uint64_t now_nanoseconds() {
+  // A coarse clock is precise enough and cheaper to read for every packet
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+// Every request sent to the UDP server starts with "XXX PLID", so the player ID
+// can be read without parsing the packet. Returns false if it is not there.
+static bool peek_player_id(std::string_view packet, uint32_t& player_id) {
+  size_t start = PACKET_ID_LEN + 1;
+  if (packet.length() < start + PLAYER_ID_MAX_LEN ||
+      packet[PACKET_ID_LEN] != ' ') {
+    return false;
+  }
+
+  player_id = 0;
+  for (size_t i = start; i < start + PLAYER_ID_MAX_LEN; ++i) {
+    if (packet[i] < '0' || packet[i] > '9') {
+      return false;
+    }
+    player_id = player_id * 10 + (uint32_t)(packet[i] - '0');
+  }
+  return true;
+}
+
+RateLimiter::RateLimiter(uint32_t __source_rate, uint32_t __player_rate)
+    : source_rate{__source_rate}, player_rate{__player_rate} {}
+
+RateLimiter::verdict RateLimiter::admit(struct sockaddr_in& addr_from,
+                                        std::string_view packet) {
+  if (source_rate == 0 && player_rate == 0) {
+    return ADMITTED;
+  }
+
+  uint64_t now = now_nanoseconds();
+  // Limit by IP address only, since a client can easily change its port
+  if (source_rate > 0 &&
+      !take(SOURCE_KEY_TAG | addr_from.sin_addr.s_addr, source_rate, now)) {
+    return OVER_SOURCE_LIMIT;
+  }
+
+  uint32_t player_id;
+  if (player_rate > 0 && peek_player_id(packet, player_id) &&
+      !take(PLAYER_KEY_TAG | player_id, player_rate, now)) {
+    return OVER_PLAYER_LIMIT;
+  }
+  return ADMITTED;
+}
+
+RateLimiterShard::Bucket& RateLimiter::findBucket(RateLimiterShard& shard,
+                                                  size_t index, uint64_t key,
+                                                  uint32_t rate,
+                                                  uint64_t now) {
+  const size_t mask = RATE_LIMIT_SHARD_SIZE - 1;
+
+  // Buckets are never removed, only reused, so an empty slot ends the search
+  RateLimiterShard::Bucket* oldest = NULL;
+  for (size_t probe = 0; probe < RATE_LIMIT_MAX_PROBES; ++probe) {
+    RateLimiterShard::Bucket& bucket = shard.buckets[(index + probe) & mask];
+    if (bucket.key == key) {
+      return bucket;
+    }
+    if (bucket.key == 0) {
+      // A key seen for the first time gets a full burst
+      bucket.key = key;
+      bucket.tokens = rate;
+      bucket.last_refill = now;
+      return bucket;
+    }
+    if (oldest == NULL || bucket.last_refill < oldest->last_refill) {
+      oldest = &bucket;
+    }
+  }
+
+  // A reused bucket starts empty, otherwise flooding the table with new keys
+  // would evict the buckets of limited keys, and give them a full burst again
+  oldest->key = key;
+  oldest->tokens = 0;
+  oldest->last_refill = now;
+  return *oldest;
+}
+
+bool RateLimiter::take(uint64_t key, uint32_t rate, uint64_t now) {
+  // The upper bits of the hash pick the shard, the lower ones the slot in it
+  uint64_t hash = (key * HASH_MULTIPLIER) >> 32;
+  RateLimiterShard& shard = shards[(hash >> 16) & (RATE_LIMIT_SHARDS - 1)];
+  std::scoped_lock<std::mutex> slock(shard.lock);
+  RateLimiterShard::Bucket& bucket =
+      findBucket(shard, (size_t)hash, key, rate, now);
+
+  // Refill the bucket according to the time since the last refill, allowing
+  // bursts of up to one second worth of packets. Another worker may have
+  // refilled it with a slightly later clock reading.
+  uint64_t elapsed = now > bucket.last_refill ? now - bucket.last_refill : 0;
+  if (elapsed >= NANOSECONDS_PER_SECOND) {
+    bucket.tokens = rate;
+    bucket.last_refill = now;
+  } else {
+    uint64_t refill = elapsed * rate / NANOSECONDS_PER_SECOND;
+    if (refill > 0) {
+      bucket.tokens =
+          (uint32_t)std::min(bucket.tokens + refill, (uint64_t)rate);
+      bucket.last_refill += refill * NANOSECONDS_PER_SECOND / rate;
+    }
+  }
+
+  if (bucket.tokens == 0) {
+    return false;
+  }
+  --bucket.tokens;
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <netinet/in.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+
+#include "common/constants.hpp"
+
+#define RATE_LIMIT_SHARD_SIZE (RATE_LIMIT_TABLE_SIZE / RATE_LIMIT_SHARDS)
+
+// Part of the rate limiter's table, with its own lock. Shards are kept on
+// separate cache lines, so workers locking different shards don't slow each
+// other down.
+class alignas(64) RateLimiterShard {
+ public:
+  struct Bucket {
+    uint64_t key = 0;  // 0 marks an empty slot
+    uint64_t last_refill = 0;
+    uint32_t tokens = 0;
+  };
+
+  std::mutex lock;
+  Bucket buckets[RATE_LIMIT_SHARD_SIZE];
+};
+
+// Token buckets for each source address and player ID, shared by all UDP
+// workers, so the limits hold no matter which worker a datagram lands on.
+// They are kept in a fixed-size open addressing table, split into
+// RATE_LIMIT_SHARDS independently locked shards. When a key is not found
+// within RATE_LIMIT_MAX_PROBES slots, the bucket that was refilled the longest
+// time ago is reused for it, so the table never grows.
+class RateLimiter {
+  RateLimiterShard shards[RATE_LIMIT_SHARDS];
+  uint32_t source_rate;
+  uint32_t player_rate;
+
+  // Must be called with the shard's lock held
+  RateLimiterShard::Bucket& findBucket(RateLimiterShard& shard, size_t index,
+                                       uint64_t key, uint32_t rate,
+                                       uint64_t now);
+  bool take(uint64_t key, uint32_t rate, uint64_t now);
+
+ public:
+  enum verdict { ADMITTED, OVER_SOURCE_LIMIT, OVER_PLAYER_LIMIT };
+
+  // A rate of 0 disables the respective limit
+  RateLimiter(uint32_t __source_rate, uint32_t __player_rate);
+  // Whether a datagram should be handled. Must be called before parsing it,
+  // so packets over the limits are dropped as cheaply as possible.
+  verdict admit(struct sockaddr_in& addr_from, std::string_view packet);
+};
+
+#endif
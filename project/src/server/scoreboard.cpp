@@ -5,6 +5,8 @@
 #include <sstream>
 
 #include "common/constants.hpp"
+#include "common/protocol.hpp"
+#include "logger.hpp"
 #include "stream_utils.hpp"
 
 ScoreboardEntry::ScoreboardEntry(ServerGame& game) {
@@ -31,12 +33,16 @@ void ScoreboardEntry::serializeEntry(std::ofstream& file) {
   write_uint32_t(file, totalTrials);
 }
 
+Scoreboard::Scoreboard() {
+  render();
+}
+
 void Scoreboard::addGame(ServerGame& game) {
   if (!game.hasWon()) {
     return;
   }
 
-  std::unique_lock scoreboard_lock(rwlock);
+  std::scoped_lock<std::mutex> slock(lock);
 
   ScoreboardEntry entry(game);
 
@@ -49,6 +55,7 @@ void Scoreboard::addGame(ServerGame& game) {
     entries.erase(entries.begin());
   }
 
+  render();
   saveToFile();
 }
 
@@ -67,11 +74,9 @@ void Scoreboard::saveToFile() {
       entry.serializeEntry(sb_stream);
     }
   } catch (std::exception& e) {
-    std::cerr << "[ERROR] Failed to save scoreboard to file: " << e.what()
-              << std::endl;
+    logger.error("Failed to save scoreboard to file: {}", e.what());
   } catch (...) {
-    std::cerr << "[ERROR] Failed to save scoreboard to file: unknown"
-              << std::endl;
+    logger.error("Failed to save scoreboard to file: unknown");
   }
 }
 
@@ -113,11 +118,10 @@ void Scoreboard::loadFromFile() {
               << std::endl;
     entries.clear();
   }
+  render();
 }
 
 std::optional<std::string> Scoreboard::toString() {
-  std::shared_lock scoreboard_lock(rwlock);
-
   if (entries.size() == 0) {
     return std::nullopt;
   }
@@ -148,3 +152,37 @@ std::optional<std::string> Scoreboard::toString() {
 
   return file.str();
 }
+
+void Scoreboard::render() {
+  std::shared_ptr<RenderedScoreboard> next =
+      std::make_shared<RenderedScoreboard>();
+  next->version = ++version;
+
+  ScoreboardClientbound packet;
+  auto scoreboard_str = toString();
+  next->empty = !scoreboard_str.has_value();
+  if (next->empty) {
+    packet.status = ScoreboardClientbound::status::EMPTY;
+  } else {
+    packet.status = ScoreboardClientbound::status::OK;
+    packet.file_name = "scoreboard.txt";
+    packet.file_data = std::move(scoreboard_str.value());
+  }
+  packet.serialize(next->response);
+
+  std::atomic_store(&rendered,
+                    std::shared_ptr<const RenderedScoreboard>(std::move(next)));
+  published_version.store(version, std::memory_order_release);
+}
+
+std::shared_ptr<const RenderedScoreboard> Scoreboard::getRendered() {
+  thread_local const Scoreboard* cached_scoreboard = NULL;
+  thread_local std::shared_ptr<const RenderedScoreboard> cached;
+
+  if (cached_scoreboard != this ||
+      cached->version != published_version.load(std::memory_order_acquire)) {
+    cached = std::atomic_load(&rendered);
+    cached_scoreboard = this;
+  }
+  return cached;
+}
@@ -1,11 +1,13 @@
 #ifndef SCOREBOARD_H
 #define SCOREBOARD_H
 
+#include <atomic>
 #include <cstdint>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
-#include <shared_mutex>
 #include <string>
 
 #include "server_game.hpp"
@@ -27,16 +29,39 @@ class ScoreboardEntry {
   }
 };
 
+// RSB response for a version of the scoreboard, rendered once and shared by
+// all replies until the scoreboard changes again
+class RenderedScoreboard {
+ public:
+  uint64_t version;
+  bool empty;
+  std::string response;
+};
+
 class Scoreboard {
-  std::shared_mutex rwlock;
+  std::mutex lock;
+  uint64_t version = 0;
+  // Only accessed with std::atomic_load and std::atomic_store, which libstdc++
+  // implements with a pool of mutexes, so readers only do that once per version
+  std::shared_ptr<const RenderedScoreboard> rendered;
+  // Version of rendered, stored after it is published
+  std::atomic<uint64_t> published_version{0};
+
+  // Both must be called with the lock held
+  std::optional<std::string> toString();
+  void render();
 
  public:
   std::multiset<ScoreboardEntry> entries;
 
+  Scoreboard();
   void addGame(ServerGame& game);
   void saveToFile();
   void loadFromFile();
-  std::optional<std::string> toString();
+  // Returns the response for the latest version. Each thread keeps the last
+  // version it loaded, so as long as the scoreboard doesn't change, this only
+  // reads an atomic counter and never locks.
+  std::shared_ptr<const RenderedScoreboard> getRendered();
 };
 
 #endif
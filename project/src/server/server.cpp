@@ -1,15 +1,18 @@
 #include "server.hpp"
 
-#include <arpa/inet.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 #include "common/common.hpp"
 #include "common/protocol.hpp"
-
-extern bool is_shutting_down;
+#include "event_loop.hpp"
+#include "logger.hpp"
+#include "udp_batch.hpp"
 
 int main(int argc, char *argv[]) {
   try {
@@ -18,46 +21,52 @@ int main(int argc, char *argv[]) {
       config.printHelp(std::cout);
       return EXIT_SUCCESS;
     }
-    GameServerState state(config.wordFilePath, config.port, config.verbose,
-                          config.random);
-    state.registerPacketHandlers();
+    logger.setLevel(config.verbose ? LOG_DEBUG : LOG_INFO);
+    GameServerState state(config);
 
+    setup_shutdown_event();
     setup_signal_handlers();
     if (config.random) {
       std::cout << "Words will be selected randomly" << std::endl;
     } else {
       std::cout << "Words will be selected sequentially" << std::endl;
     }
+    std::cout << "Serving UDP requests with " << config.udp_workers
+              << " worker thread(s)" << std::endl;
+    std::cout << "Accepting TCP connections with " << config.tcp_loops
+              << " loop thread(s)" << std::endl;
 
-    state.cdebug << "Verbose mode is active" << std::endl << std::endl;
+    logger.start();
+    logger.debug("Verbose mode is active");
 
+    auto start_time = std::chrono::steady_clock::now();
     std::thread tcp_thread(main_tcp, std::ref(state));
-    uint32_t ex_trial = 0;
-    while (!is_shutting_down) {
-      try {
-        wait_for_udp_packet(state);
-        ex_trial = 0;
-      } catch (std::exception &e) {
-        std::cerr << "Encountered unrecoverable error while running the "
-                     "application. Retrying..."
-                  << std::endl
-                  << e.what() << std::endl;
-        ex_trial++;
-      } catch (...) {
-        std::cerr << "Encountered unrecoverable error while running the "
-                     "application. Retrying..."
-                  << std::endl;
-        ex_trial++;
-      }
-      if (ex_trial >= EXCEPTION_RETRY_MAX) {
-        std::cerr << "Max trials reached, shutting down..." << std::endl;
-        is_shutting_down = true;
-      }
+    std::vector<UdpBatchStats> udp_stats(config.udp_workers);
+    std::vector<std::thread> udp_threads;
+    for (uint32_t i = 0; i < config.udp_workers; ++i) {
+      udp_threads.emplace_back(main_udp, std::ref(state), i,
+                               std::ref(udp_stats[i]));
     }
 
+    for (auto &udp_thread : udp_threads) {
+      udp_thread.join();
+    }
+    std::chrono::duration<double> uptime =
+        std::chrono::steady_clock::now() - start_time;
+
     std::cout << "Shutting down UDP server..." << std::endl;
+    UdpBatchStats total_stats;
+    for (uint32_t i = 0; i < config.udp_workers; ++i) {
+      std::cout << "[UDP worker #" << i << "] ";
+      udp_stats[i].print(std::cout, uptime.count());
+      total_stats.add(udp_stats[i]);
+    }
+    std::cout << "[UDP total] ";
+    total_stats.print(std::cout, uptime.count());
 
     tcp_thread.join();
+    state.game_table.logStats(uptime.count());
+    logger.stop();
   } catch (std::exception &e) {
     std::cerr << "Encountered unrecoverable error while running the "
                  "application. Shutting down..."
@@ -74,142 +83,144 @@ int main(int argc, char *argv[]) {
   return EXIT_SUCCESS;
 }
 
-void main_tcp(GameServerState &state) {
-  WorkerPool worker_pool(state);
+void main_udp(GameServerState &state, uint32_t worker_id,
+              UdpBatchStats &stats) {
+  int socket_fd = state.udp_socket_fds.at(worker_id);
+  UdpBatch batch;
 
-  if (listen(state.tcp_socket_fd, TCP_MAX_QUEUE_SIZE) < 0) {
-    perror("Error while executing listen");
-    std::cerr << "TCP server is being shutdown..." << std::endl;
-    is_shutting_down = true;
-    return;
+  try {
+    EventLoop loop;
+    uint32_t ex_trial = 0;
+    loop.add(socket_fd, EPOLLIN, [&](uint32_t events) {
+      (void)events;
+      try {
+        wait_for_udp_packet(state, socket_fd, batch);
+        ex_trial = 0;
+      } catch (std::exception &e) {
+        logger.error(
+            "[UDP worker #{}] Encountered unrecoverable error while running "
+            "the application. Retrying... {}",
+            worker_id, e.what());
+        ex_trial++;
+      } catch (...) {
+        logger.error(
+            "[UDP worker #{}] Encountered unrecoverable error while running "
+            "the application. Retrying...",
+            worker_id);
+        ex_trial++;
+      }
+      if (ex_trial >= EXCEPTION_RETRY_MAX) {
+        logger.error("Max trials reached, shutting down...");
+        request_shutdown();
+      }
+    });
+    loop.run();
+  } catch (std::exception &e) {
+    logger.error("[UDP worker #{}] Event loop failed, shutting down... {}",
+                 worker_id, e.what());
+    request_shutdown();
+  }
+
+  // Only publish the counters once, so workers don't share cache lines
+  // while running
+  stats = batch.stats;
+}
+
+void main_tcp(GameServerState &state) {
+  TcpScheduler scheduler(state);
+
+  for (int tcp_socket_fd : state.tcp_socket_fds) {
+    if (listen(tcp_socket_fd, (int)state.tcp_backlog) < 0) {
+      logger.error(
+          "Error while executing listen: {}. TCP server is being shutdown...",
+          strerror(errno));
+      request_shutdown();
+      return;
+    }
   }
 
-  uint32_t ex_trial = 0;
-  while (!is_shutting_down) {
+  {
+    // Each loop accepts connections from its own listening socket
+    TcpLoopGroup tcp_loops(scheduler, state.tcp_socket_fds,
+                           state.tcp_keep_alive);
     try {
-      wait_for_tcp_packet(state, worker_pool);
-      ex_trial = 0;
+      // Nothing else to do but wait for the server to shut down
+      EventLoop loop;
+      loop.run();
     } catch (std::exception &e) {
-      std::cerr << "Encountered unrecoverable error while running the "
-                   "application. Retrying..."
-                << std::endl
-                << e.what() << std::endl;
-      ex_trial++;
-    } catch (...) {
-      std::cerr << "Encountered unrecoverable error while running the "
-                   "application. Retrying..."
-                << std::endl;
-      ex_trial++;
-    }
-    if (ex_trial >= EXCEPTION_RETRY_MAX) {
-      std::cerr << "Max trials reached, shutting down..." << std::endl;
-      is_shutting_down = true;
+      logger.error("TCP event loop failed, shutting down... {}", e.what());
+      request_shutdown();
     }
-  }
 
-  std::cout << "Shutting down TCP server... This might take a while if there "
-               "are open connections. Press CTRL + C again to forcefully close "
-               "the server."
-            << std::endl;
+    logger.info(
+        "Shutting down TCP server... This might take a while if there are "
+        "open connections. Press CTRL + C again to forcefully close the "
+        "server.");
+    tcp_loops.shutdown();
+    tcp_loops.logStats();
+  }
+  scheduler.shutdown();
+  scheduler.logStats();
+  logger.info("[TCP] Hint cache: {} hit(s), {} miss(es)",
+              state.hint_cache.hits, state.hint_cache.misses);
 }
 
-void wait_for_udp_packet(GameServerState &server_state) {
-  Address addr_from;
-  std::stringstream stream;
-  char buffer[SOCKET_BUFFER_LEN];
-
-  addr_from.size = sizeof(addr_from.addr);
-  ssize_t n = recvfrom(server_state.udp_socket_fd, buffer, SOCKET_BUFFER_LEN, 0,
-                       (struct sockaddr *)&addr_from.addr, &addr_from.size);
-  if (is_shutting_down) {
-    return;
-  }
+void wait_for_udp_packet(GameServerState &server_state, int socket_fd,
+                         UdpBatch &batch) {
+  int n = batch.receive(socket_fd);
   if (n == -1) {
-    if (errno == EAGAIN) {
+    if (errno == EAGAIN || errno == EINTR) {
+      // Another worker might have been woken up too, and took the datagrams
       return;
     }
-    throw UnrecoverableError("Failed to receive UDP message (recvfrom)", errno);
+    throw UnrecoverableError("Failed to receive UDP message (recvmmsg)", errno);
   }
-  addr_from.socket = server_state.udp_socket_fd;
-
-  char addr_str[INET_ADDRSTRLEN + 1] = {0};
-  inet_ntop(AF_INET, &addr_from.addr.sin_addr, addr_str, INET_ADDRSTRLEN);
-  std::cout << "Receiving incoming UDP message from " << addr_str << ":"
-            << ntohs(addr_from.addr.sin_port) << std::endl;
 
-  stream.write(buffer, n);
+  for (uint32_t i = 0; i < batch.size(); ++i) {
+    PacketReader reader(batch.getData(i), batch.getLength(i));
+    handle_packet(reader, batch.getAddress(i), server_state, batch.stats);
+  }
 
-  return handle_packet(stream, addr_from, server_state);
+  batch.flushReplies(socket_fd);
 }
 
-void handle_packet(std::stringstream &buffer, Address &addr_from,
-                   GameServerState &server_state) {
-  try {
-    char packet_id[PACKET_ID_LEN + 1];
-    buffer >> packet_id;
+void handle_packet(PacketReader &reader, Address &addr_from,
+                   GameServerState &server_state, UdpBatchStats &stats) {
+  // Checked before anything else, so flooding the server costs it as little
+  // as possible
+  RateLimiter::verdict verdict =
+      server_state.rate_limiter.admit(addr_from.addr, reader.getPacket());
+  if (verdict == RateLimiter::OVER_SOURCE_LIMIT) {
+    ++stats.rate_limited_sources;
+    return;
+  }
+  if (verdict == RateLimiter::OVER_PLAYER_LIMIT) {
+    ++stats.rate_limited_players;
+    return;
+  }
+  logger.info("Receiving incoming UDP message from {}", addr_from.addr);
 
-    if (!buffer.good()) {
-      std::cerr << "Received malformatted packet ID" << std::endl;
-      throw InvalidPacketException();
+  try {
+    uint32_t packet_id;
+    try {
+      packet_id = reader.readAnyPacketId();
+    } catch (InvalidPacketException &e) {
+      logger.warning("Received malformatted packet ID");
+      throw;
     }
 
-    std::string packet_id_str = std::string(packet_id);
-
-    server_state.callUdpPacketHandler(packet_id_str, buffer, addr_from);
+    server_state.callUdpPacketHandler(packet_id, reader, addr_from);
   } catch (InvalidPacketException &e) {
     try {
       ErrorUdpPacket error_packet;
-      send_packet(error_packet, addr_from.socket,
-                  (struct sockaddr *)&addr_from.addr, addr_from.size);
+      send_udp_reply(error_packet, addr_from);
     } catch (std::exception &ex) {
-      std::cerr << "Failed to reply with ERR packet: " << ex.what()
-                << std::endl;
+      logger.error("Failed to reply with ERR packet: {}", ex.what());
     }
   } catch (std::exception &e) {
-    std::cerr << "Failed to handle UDP packet: " << e.what() << std::endl;
+    logger.error("Failed to handle UDP packet: {}", e.what());
   } catch (...) {
-    std::cerr << "Failed to handle UDP packet: unknown" << std::endl;
-  }
-}
-
-void wait_for_tcp_packet(GameServerState &server_state, WorkerPool &pool) {
-  Address addr_from;
-
-  addr_from.size = sizeof(addr_from.addr);
-  int connection_fd =
-      accept(server_state.tcp_socket_fd, (struct sockaddr *)&addr_from.addr,
-             &addr_from.size);
-  if (is_shutting_down) {
-    return;
-  }
-  if (connection_fd < 0) {
-    if (errno == EAGAIN) {  // timeout, just go around and keep listening
-      return;
-    }
-    throw UnrecoverableError("[ERROR] Failed to accept a connection", errno);
-  }
-
-  struct timeval read_timeout;
-  read_timeout.tv_sec = TCP_READ_TIMEOUT_SECONDS;
-  read_timeout.tv_usec = 0;
-  if (setsockopt(connection_fd, SOL_SOCKET, SO_RCVTIMEO, &read_timeout,
-                 sizeof(read_timeout)) < 0) {
-    throw UnrecoverableError("Failed to set TCP read timeout socket option",
-                             errno);
-  }
-
-  char addr_str[INET_ADDRSTRLEN + 1] = {0};
-  inet_ntop(AF_INET, &addr_from.addr.sin_addr, addr_str, INET_ADDRSTRLEN);
-  std::cout << "Receiving incoming TCP connection from " << addr_str << ":"
-            << ntohs(addr_from.addr.sin_port) << std::endl;
-
-  try {
-    pool.delegateConnection(connection_fd);
-  } catch (std::exception &e) {
-    close(connection_fd);
-    throw UnrecoverableError(
-        std::string("Failed to delegate connection to worker: ") + e.what() +
-        "\nClosing connection.");
+    logger.error("Failed to handle UDP packet: unknown");
   }
 }
 
@@ -217,11 +228,38 @@ ServerConfig::ServerConfig(int argc, char *argv[]) {
   programPath = argv[0];
   int opt;
 
-  while ((opt = getopt(argc, argv, "-p:vhr")) != -1) {
+  while ((opt = getopt(argc, argv, "-p:vhrku:t:m:w:l:b:s:i:g:")) != -1) {
     switch (opt) {
       case 'p':
         port = std::string(optarg);
         break;
+      case 'u':
+        udp_workers = parse_uint_option(opt, optarg, 1, UDP_WORKERS_MAX);
+        break;
+      case 't':
+        tcp_max_workers = parse_uint_option(opt, optarg, 1, TCP_WORKERS_MAX);
+        break;
+      case 'm':
+        tcp_min_workers = parse_uint_option(opt, optarg, 0, TCP_WORKERS_MAX);
+        break;
+      case 'w':
+        tcp_bulk_workers = parse_uint_option(opt, optarg, 1, TCP_WORKERS_MAX);
+        break;
+      case 'l':
+        tcp_loops = parse_uint_option(opt, optarg, 1, TCP_LOOPS_MAX);
+        break;
+      case 'b':
+        tcp_backlog = parse_uint_option(opt, optarg, 1, TCP_BACKLOG_MAX);
+        break;
+      case 'g':
+        max_games = parse_uint_option(opt, optarg, 1, UINT32_MAX);
+        break;
+      case 's':
+        source_rate_limit = parse_uint_option(opt, optarg, 0, RATE_LIMIT_MAX);
+        break;
+      case 'i':
+        player_rate_limit = parse_uint_option(opt, optarg, 0, RATE_LIMIT_MAX);
+        break;
       case 'h':
         help = true;
         return;
@@ -232,6 +270,9 @@ ServerConfig::ServerConfig(int argc, char *argv[]) {
       case 'r':
         random = true;
         break;
+      case 'k':
+        keep_alive = true;
+        break;
       case 1:
         // The `-` flag in `getopt` makes non-options behave as if they
         // were values of an option -0x01
@@ -256,10 +297,19 @@ ServerConfig::ServerConfig(int argc, char *argv[]) {
   }
 
   validate_port_number(port);
+  if (tcp_min_workers > tcp_max_workers) {
+    throw UnrecoverableError(
+        "Invalid value for option -m: it must not be greater than the maximum "
+        "number of TCP worker threads (" +
+        std::to_string(tcp_max_workers) + ")");
+  }
 }
 
 void ServerConfig::printHelp(std::ostream &stream) {
-  stream << "Usage: " << programPath << " word_file [-p GSport] [-v] [-t]"
+  stream << "Usage: " << programPath
+         << " word_file [-p GSport] [-v] [-r] [-k] [-u workers] [-t workers]"
+            " [-m workers] [-w workers] [-l loops] [-b backlog] [-g games]"
+            " [-s rate] [-i rate]"
          << std::endl;
   stream << "Available options:" << std::endl;
   stream << "word_file\tPath to the word file" << std::endl;
@@ -268,4 +318,51 @@ void ServerConfig::printHelp(std::ostream &stream) {
   stream << "-h\t\tEnable verbose mode." << std::endl;
   stream << "-r\t\tEnable random mode. Words will be selected randomly."
          << std::endl;
+  stream << "-u workers\tSet number of UDP worker threads. Default: number "
+            "of CPUs"
+         << std::endl;
+  stream << "-t workers\tSet maximum number of TCP worker threads. Default: "
+         << TCP_WORKER_POOL_SIZE << std::endl;
+  stream << "-m workers\tSet number of TCP worker threads kept when idle. "
+            "Default: "
+         << TCP_WORKER_POOL_MIN << std::endl;
+  stream << "-w workers\tSet maximum number of TCP worker threads for hint "
+            "requests, apart from the others. Default: "
+         << TCP_BULK_WORKER_POOL_SIZE << std::endl;
+  stream << "-l loops\tSet number of TCP loop threads, each accepting "
+            "connections on its own socket. Default: number of CPUs"
+         << std::endl;
+  stream << "-b backlog\tSet maximum number of TCP connections waiting to "
+            "be accepted by each loop. Default: "
+         << TCP_MAX_QUEUE_SIZE << std::endl;
+  stream << "-k\t\tKeep TCP connections open for more than one request."
+         << std::endl;
+  stream << "-g games\tSet maximum number of games kept in memory, the "
+            "others are loaded from disk when needed. Default: "
+         << GAME_TABLE_MAX_GAMES << std::endl;
+  stream << "-s rate\t\tSet maximum UDP packets per second from each source "
+            "address, 0 to disable. Default: 0"
+         << std::endl;
+  stream << "-i rate\t\tSet maximum UDP packets per second for each player "
+            "ID, 0 to disable. Default: 0"
+         << std::endl;
+}
+
+uint32_t parse_uint_option(int opt, const char *value, uint32_t min,
+                           uint32_t max) {
+  try {
+    size_t converted = 0;
+    std::string value_str(value);
+    long parsed = std::stol(value_str, &converted, 10);
+    if (converted != value_str.length() || parsed < (long)min ||
+        parsed > (long)max) {
+      throw std::runtime_error("");
+    }
+    return (uint32_t)parsed;
+  } catch (...) {
+    throw UnrecoverableError(std::string("Invalid value for option -") +
+                             (char)opt + ": it must be a number between " +
+                             std::to_string(min) + " and " +
+                             std::to_string(max));
+  }
 }
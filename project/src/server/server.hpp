@@ -1,12 +1,16 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <algorithm>
 #include <csignal>
+#include <thread>
 
 #include "common/constants.hpp"
 #include "server_game.hpp"
 #include "server_state.hpp"
-#include "worker_pool.hpp"
+#include "tcp_loop.hpp"
+#include "tcp_scheduler.hpp"
+#include "udp_batch.hpp"
 
 class ServerConfig {
  public:
@@ -16,18 +20,37 @@ class ServerConfig {
   bool help = false;
   bool verbose = false;
   bool random = false;
+  bool keep_alive = false;
+  uint32_t tcp_min_workers = TCP_WORKER_POOL_MIN;
+  uint32_t tcp_max_workers = TCP_WORKER_POOL_SIZE;
+  uint32_t tcp_bulk_workers = TCP_BULK_WORKER_POOL_SIZE;
+  // Rate limiting is opt-in, so players behind a shared address are never
+  // throttled unless asked for
+  uint32_t source_rate_limit = 0;
+  uint32_t player_rate_limit = 0;
+  uint32_t udp_workers = std::clamp(std::thread::hardware_concurrency(), 1u,
+                                    (uint32_t)UDP_WORKERS_MAX);
+  uint32_t tcp_loops = std::clamp(std::thread::hardware_concurrency(), 1u,
+                                  (uint32_t)TCP_LOOPS_MAX);
+  uint32_t tcp_backlog = TCP_MAX_QUEUE_SIZE;
+  uint32_t max_games = GAME_TABLE_MAX_GAMES;
 
   ServerConfig(int argc, char* argv[]);
   void printHelp(std::ostream& stream);
 };
 
-void main_tcp(GameServerState& state);
+uint32_t parse_uint_option(int opt, const char* value, uint32_t min,
+                           uint32_t max);
+
+void main_udp(GameServerState& state, uint32_t worker_id,
+              UdpBatchStats& stats);
 
-void wait_for_udp_packet(GameServerState& server_state);
+void main_tcp(GameServerState& state);
 
-void handle_packet(std::stringstream& buffer, Address& addr_from,
-                   GameServerState& server_state);
+void wait_for_udp_packet(GameServerState& server_state, int socket_fd,
+                         UdpBatch& batch);
 
-void wait_for_tcp_packet(GameServerState& server_state, WorkerPool& pool);
+void handle_packet(PacketReader& reader, Address& addr_from,
+                   GameServerState& server_state, UdpBatchStats& stats);
 
 #endif
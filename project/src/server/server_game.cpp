@@ -4,16 +4,44 @@
 #include <cstring>
 #include <fstream>
 #include <iomanip>
-#include <iostream>
 #include <stdexcept>
 
 #include "common/common.hpp"
 #include "common/constants.hpp"
+#include "logger.hpp"
 #include "stream_utils.hpp"
 
+LetterIndex::LetterIndex(std::string_view word) {
+  for (size_t i = 0; i < word.length() && i < 32; ++i) {
+    if (word[i] >= 'a' && word[i] <= 'z') {
+      masks[word[i] - 'a'] |= 1u << i;
+    }
+  }
+}
+
+uint32_t LetterIndex::count(char letter) {
+  if (letter < 'a' || letter > 'z') {
+    return 0;
+  }
+  return (uint32_t)__builtin_popcount(masks[letter - 'a']);
+}
+
+// indexes start at 1
+LetterPositions LetterIndex::positions(char letter) {
+  LetterPositions found_indexes;
+  if (letter < 'a' || letter > 'z') {
+    return found_indexes;
+  }
+  for (uint32_t mask = masks[letter - 'a']; mask != 0; mask &= mask - 1) {
+    found_indexes.push_back((uint32_t)__builtin_ctz(mask) + 1);
+  }
+  return found_indexes;
+}
+
 ServerGame::ServerGame(uint32_t __playerId, std::string __word,
-                       std::optional<std::filesystem::path> __hint_path)
-    : word{__word}, hint_path{__hint_path} {
+                       std::optional<std::filesystem::path> __hint_path,
+                       const LetterIndex &__letters)
+    : word{__word}, hint_path{__hint_path}, letters{__letters} {
   this->playerId = __playerId;
   size_t word_len = word.size();
   if (word_len <= 6) {
@@ -29,83 +57,105 @@ ServerGame::ServerGame(uint32_t __playerId, std::string __word,
   this->lettersRemaining = wordLen;
 }
 
-// indexes start at 1
-std::vector<uint32_t> ServerGame::getIndexesOfLetter(char letter) {
-  std::vector<uint32_t> found_indexes;
-  for (uint32_t i = 0; i < wordLen; i++) {
-    if (word[i] == letter) {
-      found_indexes.push_back(i + 1);
+// Bit of a letter in guessed_letters, or 0 if it is not a lowercase letter
+static uint32_t letter_bit(char letter) {
+  if (letter < 'a' || letter > 'z') {
+    return 0;
+  }
+  return 1u << (letter - 'a');
+}
+
+bool ServerGame::isGuessed(char letter) {
+  return (guessed_letters & letter_bit(letter)) != 0;
+}
+
+std::string_view ServerGame::lastWordGuess() {
+  // Skip the space ending the last guess to find the one before it
+  size_t start = word_guesses.rfind(' ', word_guesses.length() - 2);
+  start = start == std::string::npos ? 0 : start + 1;
+  return std::string_view(word_guesses)
+      .substr(start, word_guesses.length() - 1 - start);
+}
+
+uint32_t ServerGame::countLettersRemaining() {
+  uint32_t remaining = 0;
+  for (char c : word) {
+    if (!isGuessed(c)) {
+      remaining += 1;
     }
   }
-  return found_indexes;
+  return remaining;
 }
 
-std::vector<uint32_t> ServerGame::guessLetter(char letter, uint32_t trial) {
+LetterPositions ServerGame::guessLetter(char letter, uint32_t trial) {
   if (!isOnGoing()) {
     throw GameHasEndedException();
   }
 
-  if (trial != 0 && trial == plays.size()) {
+  if (trial != 0 && trial == play_count) {
     // replaying of last guess
-    if (letter != plays.at(trial - 1)) {
+    if (letter != plays[trial - 1]) {
       throw InvalidTrialException();
     }
 
-    return getIndexesOfLetter(letter);
+    return letters.positions(letter);
   }
 
-  if (trial != plays.size() + 1) {
+  if (trial != play_count + 1 || play_count == TRIAL_MAX) {
     throw InvalidTrialException();
   }
 
-  for (auto it = plays.begin(); it != plays.end(); ++it) {
-    // check if it is duplicate play
-    if (letter == *it) {
-      throw DuplicateLetterGuessException();
-    }
+  if (isGuessed(letter)) {
+    throw DuplicateLetterGuessException();
   }
 
-  plays.push_back(letter);
-  auto found_indexes = getIndexesOfLetter(letter);
+  plays[play_count++] = letter;
+  guessed_letters |= letter_bit(letter);
+  auto found_indexes = letters.positions(letter);
   if (found_indexes.size() == 0) {
     numErrors++;
   }
   currentTrial++;
-  lettersRemaining -= (uint32_t)found_indexes.size();
+  lettersRemaining -= found_indexes.size();
   if (hasWon() || hasLost()) {
     onGoing = false;
   }
   return found_indexes;
 }
 
-bool ServerGame::guessWord(std::string& word_guess, uint32_t trial) {
+bool ServerGame::guessWord(std::string_view word_guess, uint32_t trial) {
   if (!isOnGoing()) {
     throw GameHasEndedException();
   }
 
-  if (word_guesses.size() > 0 && trial == plays.size() &&
-      *(plays.end() - 1) == 0) {
+  if (!word_guesses.empty() && trial == play_count &&
+      plays[play_count - 1] == 0) {
     // replaying of last guess
-    if (*(word_guesses.end() - 1) != word_guess) {
+    if (lastWordGuess() != word_guess) {
       throw InvalidTrialException();
     }
 
     return word == word_guess;
   }
 
-  if (trial != plays.size() + 1) {
+  if (trial != play_count + 1 || play_count == TRIAL_MAX) {
     throw InvalidTrialException();
   }
 
-  for (auto it = word_guesses.begin(); it != word_guesses.end(); ++it) {
+  size_t start = 0;
+  while (start < word_guesses.length()) {
     // check if it is duplicate play
-    if (word_guess == *it) {
+    size_t end = word_guesses.find(' ', start);
+    if (std::string_view(word_guesses).substr(start, end - start) ==
+        word_guess) {
       throw DuplicateWordGuessException();
     }
+    start = end + 1;
   }
 
-  plays.push_back(0);
-  word_guesses.push_back(word_guess);
+  plays[play_count++] = 0;
+  word_guesses.append(word_guess);
+  word_guesses.push_back(' ');
   currentTrial++;
   if (word == word_guess) {
     lettersRemaining = 0;
@@ -150,21 +200,26 @@ std::string ServerGame::getStateString() {
           << std::endl;
   }
 
-  if (plays.size() == 0) {
+  if (play_count == 0) {
     state << "     Game started - no transactions found" << std::endl;
   } else {
-    state << "     --- Transactions found: " << plays.size() << " ---"
+    state << "     --- Transactions found: " << play_count << " ---"
           << std::endl;
   }
 
-  auto next_word = word_guesses.begin();
-  for (char play : plays) {
+  size_t next_word = 0;
+  for (uint32_t i = 0; i < play_count; ++i) {
+    char play = plays[i];
     if (play == 0) {
-      state << "     Word guess: " << *next_word << std::endl;
-      ++next_word;
+      size_t end = word_guesses.find(' ', next_word);
+      state << "     Word guess: "
+            << std::string_view(word_guesses)
+                   .substr(next_word, end - next_word)
+            << std::endl;
+      next_word = end + 1;
     } else {
       state << "     Letter trial: " << play << " - ";
-      if (word.find(play) != std::string::npos) {
+      if (letters.count(play) > 0) {
         state << "TRUE";
       } else {
         state << "FALSE";
@@ -195,12 +250,10 @@ std::string ServerGame::getWord() {
 }
 
 std::string ServerGame::getWordProgress() {
-  std::string result;
-  for (char c : word) {
-    if (std::find(plays.begin(), plays.end(), c) != plays.end()) {
-      result += c;
-    } else {
-      result += '-';
+  std::string result(word);
+  for (char& c : result) {
+    if (!isGuessed(c)) {
+      c = '-';
     }
   }
   return result;
@@ -241,24 +294,28 @@ void ServerGame::saveToFile() {
     write_uint32_t(game_stream, currentTrial);
     write_bool(game_stream, onGoing);
     write_uint32_t(game_stream, maxErrors);
-    write_uint32_t(game_stream, (uint32_t)plays.size());
-    for (char c : plays) {
-      game_stream.put(c);
-    }
-    write_uint32_t(game_stream, (uint32_t)word_guesses.size());
-    for (std::string& guess : word_guesses) {
+    write_uint32_t(game_stream, play_count);
+    game_stream.write(plays, play_count);
+    uint32_t word_guess_count =
+        (uint32_t)std::count(word_guesses.begin(), word_guesses.end(), ' ');
+    write_uint32_t(game_stream, word_guess_count);
+    size_t start = 0;
+    while (start < word_guesses.length()) {
+      size_t end = word_guesses.find(' ', start);
+      std::string guess = word_guesses.substr(start, end - start);
       write_string(game_stream, guess);
+      start = end + 1;
     }
 
     // Derived:
     // lettersRemaining
     // wordLen
   } catch (std::exception& e) {
-    std::cerr << "[ERROR] Failed to save game (player " << playerId
-              << ") to file: " << e.what() << std::endl;
+    logger.error("{}Failed to save game to file: {}", playerTag(playerId),
+                 e.what());
   } catch (...) {
-    std::cerr << "[ERROR] Failed to save game (player " << playerId
-              << ") to file: unknown" << std::endl;
+    logger.error("{}Failed to save game to file: unknown",
+                 playerTag(playerId));
   }
 }
 
@@ -296,14 +353,19 @@ bool ServerGame::loadFromFile(bool on_going_only) {
     bool new_on_going = read_bool(game_stream);
     uint32_t new_max_errors = read_uint32_t(game_stream);
     uint32_t plays_size = read_uint32_t(game_stream);
-    std::vector<char> new_plays;
-    for (uint32_t i = 0; i < plays_size; ++i) {
-      new_plays.push_back((char)game_stream.get());
+    if (plays_size > TRIAL_MAX) {
+      throw std::runtime_error("too many trials");
     }
+    char new_plays[TRIAL_MAX];
+    game_stream.read(new_plays, plays_size);
     uint32_t word_guesses_size = read_uint32_t(game_stream);
-    std::vector<std::string> new_word_guesses;
+    if (word_guesses_size > plays_size) {
+      throw std::runtime_error("too many word guesses");
+    }
+    std::string new_word_guesses;
     for (uint32_t i = 0; i < word_guesses_size; ++i) {
-      new_word_guesses.push_back(read_string(game_stream));
+      new_word_guesses.append(read_string(game_stream));
+      new_word_guesses.push_back(' ');
     }
 
     if (!game_stream.good()) {
@@ -315,6 +377,7 @@ bool ServerGame::loadFromFile(bool on_going_only) {
     }
 
     word = new_word;
+    letters = LetterIndex(word);
     if (has_hint) {
       hint_path = std::filesystem::path(hint_path_str);
     } else {
@@ -325,30 +388,65 @@ bool ServerGame::loadFromFile(bool on_going_only) {
     currentTrial = new_current_trial;
     onGoing = new_on_going;
     maxErrors = new_max_errors;
-    plays = new_plays;
+    memcpy(plays, new_plays, plays_size);
+    play_count = plays_size;
     word_guesses = new_word_guesses;
 
     // Derived:
     wordLen = (uint32_t)word.length();
-    lettersRemaining = 0;
-    for (char c : word) {
-      if (std::find(plays.begin(), plays.end(), c) == plays.end()) {
-        lettersRemaining += 1;
-      }
+    guessed_letters = 0;
+    for (uint32_t i = 0; i < play_count; ++i) {
+      guessed_letters |= letter_bit(plays[i]);
     }
-    if (word_guesses.size() >= 1 && word == word_guesses.back()) {
+    lettersRemaining = countLettersRemaining();
+    if (!word_guesses.empty() && word == lastWordGuess()) {
       lettersRemaining = 0;
     }
 
-    std::cout << "Loaded game for player " << playerId << " from file"
-              << std::endl;
+    logger.info("{}Loaded game from file", playerTag(playerId));
     return true;
   } catch (std::exception& e) {
-    std::cerr << "[ERROR] Failed to save game (player " << playerId
-              << ") to file: " << e.what() << std::endl;
+    logger.error("{}Failed to load game from file: {}", playerTag(playerId),
+                 e.what());
   } catch (...) {
-    std::cerr << "[ERROR] Failed to save game (player " << playerId
-              << ") to file: unknown" << std::endl;
+    logger.error("{}Failed to load game from file: unknown",
+                 playerTag(playerId));
   }
   return false;
 }
+
+std::optional<std::string_view> ServerGame::getCachedReply(
+    uint32_t trial, std::string_view request) {
+  // Only the last trial can be replayed
+  if (cached_reply.trial == 0 || cached_reply.trial != trial ||
+      trial != play_count) {
+    return std::nullopt;
+  }
+  if (std::string_view(cached_reply.request, cached_reply.request_length) !=
+      request) {
+    return std::nullopt;
+  }
+  return std::string_view(cached_reply.reply, cached_reply.reply_length);
+}
+
+std::string_view ServerGame::cacheReply(uint32_t trial,
+                                        std::string_view request,
+                                        UdpPacket& reply) {
+  // Invalidate first, in case serialization fails halfway
+  cached_reply.trial = 0;
+
+  UdpPacketWriter writer(cached_reply.reply, CACHED_REPLY_LEN);
+  reply.serialize(writer);
+  cached_reply.reply_length = (uint32_t)writer.getLength();
+
+  if (request.length() <= CACHED_REPLY_LEN) {
+    memcpy(cached_reply.request, request.data(), request.length());
+    cached_reply.request_length = (uint32_t)request.length();
+    cached_reply.trial = trial;
+  }
+  return std::string_view(cached_reply.reply, cached_reply.reply_length);
+}
+
+void ServerGame::clearCachedReply() {
+  cached_reply.trial = 0;
+}
@@ -2,30 +2,75 @@
 #define SERVER_GAME_H
 
 #include <filesystem>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <stdexcept>
-#include <vector>
+#include <string>
+#include <string_view>
 
+#include "common/constants.hpp"
 #include "common/game.hpp"
+#include "common/protocol.hpp"
 
+// The serialized reply to the last guess of a game, so that retransmissions of
+// that guess can be answered without recomputing it. Guesses and their replies
+// are much shorter than a datagram, so only CACHED_REPLY_LEN bytes are kept.
+class CachedReply {
+ public:
+  uint32_t trial = 0;  // 0 when there is no cached reply
+  uint32_t request_length = 0;
+  uint32_t reply_length = 0;
+  char request[CACHED_REPLY_LEN];
+  char reply[CACHED_REPLY_LEN];
+};
+
+// Positions of each letter in a word, as one bitmask per letter with bit i set
+// when the letter is at index i, so guesses are answered without scanning the
+// word. Only lowercase letters are indexed, since guesses are always lowercase.
+class LetterIndex {
+  uint32_t masks[26] = {};
+
+ public:
+  LetterIndex() = default;
+  explicit LetterIndex(std::string_view word);
+  uint32_t count(char letter);
+  LetterPositions positions(char letter);
+};
+
+// A game as kept by the server. Its plays are stored inline, and letter
+// guesses are also kept as a mask, so checking for a duplicate letter or
+// rendering the progress never scans the plays.
 class ServerGame : public Game {
  private:
   std::string word;
   std::optional<std::filesystem::path> hint_path;
+  LetterIndex letters;
   uint32_t lettersRemaining;
-  std::vector<char> plays;
-  std::vector<std::string> word_guesses;
-
-  std::vector<uint32_t> getIndexesOfLetter(char letter);
+  // Bit i is set once letter 'a' + i has been guessed
+  uint32_t guessed_letters = 0;
+  // Letter guessed in each trial, or 0 for a word guess
+  char plays[TRIAL_MAX];
+  uint32_t play_count = 0;
+  // Word guesses, in order, each followed by a space
+  std::string word_guesses;
+  CachedReply cached_reply;
+
+  bool isGuessed(char letter);
+  std::string_view lastWordGuess();
+  uint32_t countLettersRemaining();
 
  public:
   std::mutex lock;
+  // Set, with the lock held, when the game was added to the game table but
+  // could not be loaded from its file, and was taken out again
+  bool missing = false;
 
   ServerGame(uint32_t __playerId, std::string __word,
-             std::optional<std::filesystem::path> __hint_path);
-  std::vector<uint32_t> guessLetter(char letter, uint32_t trial);
-  bool guessWord(std::string& word, uint32_t trial);
+             std::optional<std::filesystem::path> __hint_path,
+             const LetterIndex& __letters);
+  LetterPositions guessLetter(char letter, uint32_t trial);
+  bool guessWord(std::string_view word, uint32_t trial);
   bool hasLost();
   bool hasWon();
   bool hasStarted();
@@ -37,16 +82,24 @@ class ServerGame : public Game {
   std::string getHintFileName();
   void saveToFile();
   bool loadFromFile(bool on_going_only);
+  std::optional<std::string_view> getCachedReply(uint32_t trial,
+                                                 std::string_view request);
+  std::string_view cacheReply(uint32_t trial, std::string_view request,
+                              UdpPacket& reply);
+  void clearCachedReply();
 };
 
 class ServerGameSync {
  private:
+  // Keeps the game alive, even if it is evicted or replaced in the meantime
+  std::shared_ptr<ServerGame> game_ptr;
   std::unique_lock<std::mutex> slock;
 
  public:
   ServerGame& game;
 
-  ServerGameSync(ServerGame& __game) : slock{__game.lock}, game{__game} {};
+  ServerGameSync(std::shared_ptr<ServerGame> __game)
+      : game_ptr{__game}, slock{__game->lock}, game{*__game} {};
 
   ServerGame& operator*() {
     return game;
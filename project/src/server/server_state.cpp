@@ -1,5 +1,6 @@
 #include "server_state.hpp"
 
+#include <linux/filter.h>
 #include <unistd.h>
 
 #include <cstring>
@@ -9,25 +10,32 @@
 
 #include "common/common.hpp"
 #include "common/protocol.hpp"
+#include "logger.hpp"
 #include "packet_handlers.hpp"
-
-GameServerState::GameServerState(std::string &__word_file_path,
-                                 std::string &port, bool __verbose,
-                                 bool __select_randomly)
-    : select_randomly{__select_randomly}, cdebug{DebugStream(__verbose)} {
-  this->setup_sockets();
-  this->resolveServerAddress(port);
-  this->registerWords(__word_file_path);
+#include "server.hpp"
+
+GameServerState::GameServerState(ServerConfig &config)
+    : select_randomly{config.random},
+      game_table{config.max_games},
+      tcp_min_workers{config.tcp_min_workers},
+      tcp_max_workers{config.tcp_max_workers},
+      tcp_bulk_workers{config.tcp_bulk_workers},
+      tcp_keep_alive{config.keep_alive},
+      tcp_backlog{config.tcp_backlog},
+      rate_limiter{config.source_rate_limit, config.player_rate_limit} {
+  this->setup_sockets(config.udp_workers, config.tcp_loops);
+  this->resolveServerAddress(config.port);
+  this->registerWords(config.wordFilePath);
   this->scoreboard.loadFromFile();
   srand((uint32_t)time(NULL));  // Initialize rand seed
 }
 
 GameServerState::~GameServerState() {
-  if (this->udp_socket_fd != -1) {
-    close(this->udp_socket_fd);
+  for (int udp_socket_fd : this->udp_socket_fds) {
+    close(udp_socket_fd);
   }
-  if (this->tcp_socket_fd != -1) {
-    close(this->tcp_socket_fd);
+  for (int tcp_socket_fd : this->tcp_socket_fds) {
+    close(tcp_socket_fd);
   }
   if (this->server_udp_addr != NULL) {
     freeaddrinfo(this->server_udp_addr);
@@ -37,59 +45,110 @@ GameServerState::~GameServerState() {
   }
 }
 
-void GameServerState::registerPacketHandlers() {
-  // UDP
-  udp_packet_handlers.insert({StartGameServerbound::ID, handle_start_game});
-  udp_packet_handlers.insert({GuessLetterServerbound::ID, handle_guess_letter});
-  udp_packet_handlers.insert({GuessWordServerbound::ID, handle_guess_word});
-  udp_packet_handlers.insert({QuitGameServerbound::ID, handle_quit_game});
-  udp_packet_handlers.insert({RevealWordServerbound::ID, handle_reveal_word});
-
-  // TCP
-  tcp_packet_handlers.insert({ScoreboardServerbound::ID, handle_scoreboard});
-  tcp_packet_handlers.insert({HintServerbound::ID, handle_hint});
-  tcp_packet_handlers.insert({StateServerbound::ID, handle_state});
-}
+void GameServerState::setup_sockets(uint32_t udp_workers,
+                                    uint32_t tcp_loops) {
+  // Create a UDP socket for each worker. They all bind to the same port with
+  // SO_REUSEPORT, and a steering program picks the worker from the player ID
+  // in each datagram (see steer_udp_by_player).
+  // All listening sockets are non-blocking, since they are only read from once
+  // epoll reports they are ready.
+  for (uint32_t i = 0; i < udp_workers; ++i) {
+    int udp_socket_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (udp_socket_fd == -1) {
+      throw UnrecoverableError("Failed to create a UDP socket", errno);
+    }
+    this->udp_socket_fds.push_back(udp_socket_fd);
 
-void GameServerState::setup_sockets() {
-  // Create a UDP socket
-  if ((this->udp_socket_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
-    throw UnrecoverableError("Failed to create a UDP socket", errno);
+    const int enable_udp = 1;
+    if (setsockopt(udp_socket_fd, SOL_SOCKET, SO_REUSEPORT, &enable_udp,
+                   sizeof(int)) < 0) {
+      throw UnrecoverableError("Failed to set UDP reuse port socket option",
+                               errno);
+    }
   }
-  struct timeval read_timeout_udp;
-  read_timeout_udp.tv_sec = SERVER_RECV_RESTART_TIMEOUT_SECONDS;
-  read_timeout_udp.tv_usec = 0;
-  if (setsockopt(this->udp_socket_fd, SOL_SOCKET, SO_RCVTIMEO,
-                 &read_timeout_udp, sizeof(read_timeout_udp)) < 0) {
-    throw UnrecoverableError("Failed to set UDP read timeout socket option",
-                             errno);
+
+  // Likewise, create a listening TCP socket for each TCP loop, so the kernel
+  // spreads new connections between their accept queues
+  for (uint32_t i = 0; i < tcp_loops; ++i) {
+    int tcp_socket_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (tcp_socket_fd == -1) {
+      throw UnrecoverableError("Failed to create a TCP socket", errno);
+    }
+    this->tcp_socket_fds.push_back(tcp_socket_fd);
+
+    const int enable = 1;
+    if (setsockopt(tcp_socket_fd, SOL_SOCKET, SO_REUSEADDR, &enable,
+                   sizeof(int)) < 0) {
+      throw UnrecoverableError("Failed to set TCP reuse address socket option",
+                               errno);
+    }
+    if (setsockopt(tcp_socket_fd, SOL_SOCKET, SO_REUSEPORT, &enable,
+                   sizeof(int)) < 0) {
+      throw UnrecoverableError("Failed to set TCP reuse port socket option",
+                               errno);
+    }
   }
+}
 
-  // Create a TCP socket
-  if ((this->tcp_socket_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-    throw UnrecoverableError("Failed to create a TCP socket", errno);
+void GameServerState::steer_udp_by_player() {
+  // Without a program, the kernel hashes the source address and port, so a
+  // player whose client changes ports would move between workers. This
+  // classic BPF program sends every request to worker (player ID % workers),
+  // which keeps each game and its rate limit bucket on a single worker.
+  // The kernel runs it with the UDP header already pulled, so offset 0 is
+  // the start of the payload: a 3 letter code, a space and the player ID.
+  // Datagrams that are too short or have a non-digit there return an
+  // out of range index, and fall back to the hash.
+  const uint32_t id_offset = PACKET_ID_LEN + 1;
+  std::vector<struct sock_filter> code;
+  // Jumps to the fallback, when their condition is true or false
+  std::vector<size_t> fallback_if_true;
+  std::vector<size_t> fallback_if_false;
+
+  code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0));
+  fallback_if_false.push_back(code.size());
+  code.push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+                          id_offset + PLAYER_ID_MAX_LEN, 0, 0));
+  code.push_back(BPF_STMT(BPF_LD | BPF_IMM, 0));
+  code.push_back(BPF_STMT(BPF_ST, 0));
+  for (uint32_t i = 0; i < PLAYER_ID_MAX_LEN; ++i) {
+    // M[0] = M[0] * 10 + digit
+    code.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, id_offset + i));
+    fallback_if_true.push_back(code.size());
+    code.push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, '0' + 10, 0, 0));
+    fallback_if_false.push_back(code.size());
+    code.push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, '0', 0, 0));
+    code.push_back(BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, '0'));
+    code.push_back(BPF_STMT(BPF_MISC | BPF_TAX, 0));
+    code.push_back(BPF_STMT(BPF_LD | BPF_MEM, 0));
+    code.push_back(BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 10));
+    code.push_back(BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0));
+    code.push_back(BPF_STMT(BPF_ST, 0));
   }
-  const int enable = 1;
-  if (setsockopt(this->tcp_socket_fd, SOL_SOCKET, SO_REUSEADDR, &enable,
-                 sizeof(int)) < 0) {
-    throw UnrecoverableError("Failed to set TCP reuse address socket option",
-                             errno);
+  code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,
+                          (uint32_t)this->udp_socket_fds.size()));
+  code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+  size_t fallback_index = code.size();
+  code.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+
+  // Jump offsets are relative to the next instruction
+  for (size_t index : fallback_if_true) {
+    code.at(index).jt = (uint8_t)(fallback_index - index - 1);
   }
-  struct timeval read_timeout;
-  read_timeout.tv_sec = SERVER_RECV_RESTART_TIMEOUT_SECONDS;
-  read_timeout.tv_usec = 0;
-  if (setsockopt(this->tcp_socket_fd, SOL_SOCKET, SO_RCVTIMEO, &read_timeout,
-                 sizeof(read_timeout)) < 0) {
-    throw UnrecoverableError("Failed to set TCP read timeout socket option",
-                             errno);
+  for (size_t index : fallback_if_false) {
+    code.at(index).jf = (uint8_t)(fallback_index - index - 1);
   }
-  struct timeval write_timeout;
-  write_timeout.tv_sec = TCP_WRITE_TIMEOUT_SECONDS;
-  write_timeout.tv_usec = 0;
-  if (setsockopt(this->tcp_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &write_timeout,
-                 sizeof(write_timeout)) < 0) {
-    throw UnrecoverableError("Failed to set TCP write timeout socket option",
-                             errno);
+
+  struct sock_fprog program;
+  program.len = (unsigned short)code.size();
+  program.filter = code.data();
+  // The program applies to the whole group, so it is attached to one socket
+  if (setsockopt(this->udp_socket_fds.front(), SOL_SOCKET,
+                 SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0) {
+    std::cerr << "[WARNING] Failed to attach the UDP steering program ("
+              << strerror(errno)
+              << "), players are spread by source address and port instead"
+              << std::endl;
   }
 }
 
@@ -108,10 +167,15 @@ void GameServerState::resolveServerAddress(std::string &port) {
         std::string("Failed to get address for UDP connection: ") +
         gai_strerror(addr_res));
   }
-  // bind socket
-  if (bind(this->udp_socket_fd, this->server_udp_addr->ai_addr,
-           this->server_udp_addr->ai_addrlen)) {
-    throw UnrecoverableError("Failed to bind UDP address", errno);
+  // bind sockets
+  for (int udp_socket_fd : this->udp_socket_fds) {
+    if (bind(udp_socket_fd, this->server_udp_addr->ai_addr,
+             this->server_udp_addr->ai_addrlen)) {
+      throw UnrecoverableError("Failed to bind UDP address", errno);
+    }
+  }
+  if (this->udp_socket_fds.size() > 1) {
+    this->steer_udp_by_player();
   }
 
   // Get TCP address
@@ -126,9 +190,11 @@ void GameServerState::resolveServerAddress(std::string &port) {
         gai_strerror(addr_res));
   }
 
-  if (bind(this->tcp_socket_fd, this->server_tcp_addr->ai_addr,
-           this->server_tcp_addr->ai_addrlen)) {
-    throw UnrecoverableError("Failed to bind TCP address", errno);
+  for (int tcp_socket_fd : this->tcp_socket_fds) {
+    if (bind(tcp_socket_fd, this->server_tcp_addr->ai_addr,
+             this->server_tcp_addr->ai_addrlen)) {
+      throw UnrecoverableError("Failed to bind TCP address", errno);
+    }
   }
 
   std::cout << "Listening for connections on port " << port << std::endl;
@@ -151,6 +217,7 @@ void GameServerState::registerWords(std::string &__word_file_path) {
       auto split_index = line.find(' ');
       Word word;
       word.word = line.substr(0, split_index);
+      word.letters = LetterIndex(word.word);
 
       if (word.word.length() < WORD_MIN_LEN ||
           word.word.length() > WORD_MAX_LEN) {
@@ -200,94 +267,134 @@ Word &GameServerState::selectRandomWord() {
   if (select_randomly) {
     index = (uint32_t)rand() % (uint32_t)this->words.size();
   } else {
-    index = (this->current_word_index) % (uint32_t)this->words.size();
-    this->current_word_index = index + 1;
+    index = this->current_word_index.fetch_add(1) %
+            (uint32_t)this->words.size();
   }
   return this->words[index];
 }
 
-void GameServerState::callUdpPacketHandler(std::string packet_id,
-                                           std::stringstream &stream,
+// Packet IDs are dispatched with a switch over their compile-time codes, which
+// avoids building and hashing strings for every packet
+void GameServerState::callUdpPacketHandler(uint32_t packet_id,
+                                           PacketReader &reader,
                                            Address &addr_from) {
-  auto handler = this->udp_packet_handlers.find(packet_id);
-  if (handler == this->udp_packet_handlers.end()) {
-    cdebug << "Received unknown Packet ID" << std::endl;
-    throw InvalidPacketException();
+  switch (packet_id) {
+    case packet_id_code(StartGameServerbound::ID):
+      return handle_start_game(reader, addr_from, *this);
+    case packet_id_code(GuessLetterServerbound::ID):
+      return handle_guess_letter(reader, addr_from, *this);
+    case packet_id_code(GuessWordServerbound::ID):
+      return handle_guess_word(reader, addr_from, *this);
+    case packet_id_code(QuitGameServerbound::ID):
+      return handle_quit_game(reader, addr_from, *this);
+    case packet_id_code(RevealWordServerbound::ID):
+      return handle_reveal_word(reader, addr_from, *this);
+    default:
+      logger.debug("Received unknown Packet ID");
+      throw InvalidPacketException();
   }
-
-  handler->second(stream, addr_from, *this);
 }
 
-void GameServerState::callTcpPacketHandler(std::string packet_id,
-                                           int connection_fd) {
-  auto handler = this->tcp_packet_handlers.find(packet_id);
-  if (handler == this->tcp_packet_handlers.end()) {
-    cdebug << "Received unknown Packet ID" << std::endl;
-    throw InvalidPacketException();
+void GameServerState::callTcpPacketHandler(uint32_t packet_id,
+                                           PacketReader &reader,
+                                           TcpResponse &response) {
+  switch (packet_id) {
+    case packet_id_code(ScoreboardServerbound::ID):
+      return handle_scoreboard(reader, response, *this);
+    case packet_id_code(HintServerbound::ID):
+      return handle_hint(reader, response, *this);
+    case packet_id_code(StateServerbound::ID):
+      return handle_state(reader, response, *this);
+    default:
+      logger.debug("Received unknown Packet ID");
+      throw InvalidPacketException();
   }
-
-  handler->second(connection_fd, *this);
 }
 
-ServerGameSync GameServerState::createGame(uint32_t player_id) {
-  std::scoped_lock<std::mutex> g_lock(gamesLock);
+// Games are loaded from their file with only the game's own lock held, so a
+// slow disk doesn't block the other players of the shard. A new entry is
+// locked before the shard lock is released, so anyone finding it waits for
+// the load to finish. The shard lock is never taken while waiting for a game
+// lock, except for a game no one else can see yet.
 
-  auto game = games.find(player_id);
-  if (game != games.end()) {
-    {
-      ServerGameSync game_sync = ServerGameSync(game->second);
-      if (game_sync->isOnGoing()) {
+ServerGameSync GameServerState::createGame(uint32_t player_id) {
+  GameTableShard &shard = game_table.shardFor(player_id);
+
+  while (true) {
+    std::unique_lock<std::mutex> g_lock(shard.lock);
+    std::shared_ptr<ServerGame> game = shard.find(player_id);
+    if (game == NULL) {
+      Word &word = this->selectRandomWord();
+      game = std::make_shared<ServerGame>(player_id, word.word, word.hint_path,
+                                          word.letters);
+      shard.insert(player_id, game);
+      ServerGameSync game_sync(game);
+      g_lock.unlock();
+
+      if (game_sync->loadFromFile(true)) {
+        {
+          std::scoped_lock<std::mutex> slock(shard.lock);
+          ++shard.loads;
+        }
+        // Loaded from file successfully, recheck if it has started
         if (game_sync->hasStarted()) {
           throw GameAlreadyStartedException();
         }
-        return game_sync;
       }
+      return game_sync;
     }
+    g_lock.unlock();
 
-    std::cout << "Deleting game" << std::endl;
-    // Delete existing game, so we can create a new one below
-    games.erase(game);
-  }
-
-  Word &word = this->selectRandomWord();
-  // Some C++ magic to create an instance of the class inside the map, without
-  // moving it, since mutexes can't be moved
-  auto inserted = games.emplace(
-      std::piecewise_construct, std::forward_as_tuple(player_id),
-      std::forward_as_tuple(player_id, word.word, word.hint_path));
-
-  if (inserted.first->second.loadFromFile(true)) {
-    // Loaded from file successfully, recheck if it has started
-    if (inserted.first->second.hasStarted()) {
-      throw GameAlreadyStartedException();
+    ServerGameSync game_sync(game);
+    if (game_sync->missing) {
+      // Taken out of the table while we waited for it
+      continue;
+    }
+    if (game_sync->isOnGoing()) {
+      if (game_sync->hasStarted()) {
+        throw GameAlreadyStartedException();
+      }
+      return game_sync;
     }
-    return ServerGameSync(inserted.first->second);
-  }
 
-  return ServerGameSync(games.at(player_id));
+    logger.info("{}Deleting game", playerTag(player_id));
+    // Delete existing game, so a new one is created on the next attempt
+    std::scoped_lock<std::mutex> slock(shard.lock);
+    shard.eraseGame(player_id, game);
+  }
 }
 
 ServerGameSync GameServerState::getGame(uint32_t player_id) {
-  std::scoped_lock<std::mutex> g_lock(gamesLock);
-
-  auto game = games.find(player_id);
-  if (game == games.end()) {
-    // Try to load from disk
-
-    // Some C++ magic to create an instance of the class inside the map, without
-    // moving it, since mutexes can't be moved
-    auto inserted = games.emplace(
-        std::piecewise_construct, std::forward_as_tuple(player_id),
-        std::forward_as_tuple(player_id, std::string(), std::nullopt));
-
-    if (!inserted.first->second.loadFromFile(false)) {
-      // Failed to load, throw exception
-      games.erase(inserted.first);
+  GameTableShard &shard = game_table.shardFor(player_id);
+
+  std::unique_lock<std::mutex> g_lock(shard.lock);
+  std::shared_ptr<ServerGame> game = shard.find(player_id);
+  if (game != NULL) {
+    g_lock.unlock();
+    ServerGameSync game_sync(game);
+    if (game_sync->missing) {
+      // Another request failed to load it meanwhile
       throw NoGameFoundException();
     }
-
-    return ServerGameSync(inserted.first->second);
+    return game_sync;
   }
 
-  return ServerGameSync(game->second);
+  // Try to load from disk, either because it was evicted or because it was
+  // played before the server restarted
+  game = std::make_shared<ServerGame>(player_id, std::string(), std::nullopt,
+                                      LetterIndex());
+  shard.insert(player_id, game);
+  ServerGameSync game_sync(game);
+  g_lock.unlock();
+
+  bool loaded = game_sync->loadFromFile(false);
+  g_lock.lock();
+  if (!loaded) {
+    game_sync->missing = true;
+    shard.eraseGame(player_id, game);
+    // Failed to load, throw exception
+    throw NoGameFoundException();
+  }
+  ++shard.loads;
+  return game_sync;
 }
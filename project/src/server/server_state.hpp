@@ -3,98 +3,80 @@
 
 #include <netdb.h>
 
+#include <atomic>
 #include <filesystem>
 #include <iostream>
 #include <optional>
 #include <sstream>
 #include <unordered_map>
 
+#include "common/protocol.hpp"
+#include "game_table.hpp"
+#include "hint_cache.hpp"
+#include "rate_limiter.hpp"
 #include "scoreboard.hpp"
 #include "server_game.hpp"
 
+class UdpBatch;
+class TcpResponse;
+
 class Address {
  public:
   int socket;
   struct sockaddr_in addr;
   socklen_t size;
+  UdpBatch* batch = NULL;
 };
 
 struct Word {
   std::string word;
   std::optional<std::filesystem::path> hint_path;
+  // Built once when the words are loaded, and copied into each game
+  LetterIndex letters;
 };
 
-class DebugStream {
-  bool active;
-
- public:
-  DebugStream(bool __active) : active{__active} {};
-
-  template <class T>
-  DebugStream& operator<<(T val) {
-    if (active) {
-      std::cout << val;
-    }
-    return *this;
-  }
-
-  DebugStream& operator<<(std::ostream& (*f)(std::ostream&)) {
-    if (active) {
-      f(std::cout);
-    }
-    return *this;
-  }
-
-  DebugStream& operator<<(std::ostream& (*f)(std::ios&)) {
-    if (active) {
-      f(std::cout);
-    }
-    return *this;
-  }
-
-  DebugStream& operator<<(std::ostream& (*f)(std::ios_base&)) {
-    if (active) {
-      f(std::cout);
-    }
-    return *this;
-  }
-};
-
-class GameServerState;
-
-typedef void (*UdpPacketHandler)(std::stringstream&, Address&,
-                                 GameServerState&);
-typedef void (*TcpPacketHandler)(int connection_fd, GameServerState&);
+class ServerConfig;
 
 class GameServerState {
-  std::unordered_map<std::string, UdpPacketHandler> udp_packet_handlers;
-  std::unordered_map<std::string, TcpPacketHandler> tcp_packet_handlers;
-  std::unordered_map<uint32_t, ServerGame> games;
   std::vector<Word> words;
-  std::mutex gamesLock;
   std::string word_file_dir;
-  uint32_t current_word_index = 0;
+  // Games in different shards are created concurrently
+  std::atomic<uint32_t> current_word_index{0};
   bool select_randomly;
-  void setup_sockets();
+  void setup_sockets(uint32_t udp_workers, uint32_t tcp_loops);
+  void steer_udp_by_player();
 
  public:
-  int udp_socket_fd = -1;
-  int tcp_socket_fd = -1;
+  // One SO_REUSEPORT socket per UDP worker thread
+  std::vector<int> udp_socket_fds;
+  // One SO_REUSEPORT listening socket per TCP loop thread
+  std::vector<int> tcp_socket_fds;
   struct addrinfo* server_udp_addr = NULL;
   struct addrinfo* server_tcp_addr = NULL;
+  GameTable game_table;
   Scoreboard scoreboard;
-  DebugStream cdebug;
-
-  GameServerState(std::string& __word_file_path, std::string& port,
-                  bool __verbose, bool __select_randomly);
+  HintCache hint_cache;
+  uint32_t tcp_min_workers;
+  uint32_t tcp_max_workers;
+  // Maximum worker threads for hint requests, apart from the others
+  uint32_t tcp_bulk_workers;
+  // Whether TCP connections are kept open for more than one request
+  bool tcp_keep_alive;
+  uint32_t tcp_backlog;
+  // Shared by all UDP workers
+  RateLimiter rate_limiter;
+
+  GameServerState(ServerConfig& config);
   ~GameServerState();
   void resolveServerAddress(std::string& port);
-  void registerPacketHandlers();
   void registerWords(std::string& __word_file_path);
   Word& selectRandomWord();
-  void callUdpPacketHandler(std::string packet_id, std::stringstream& stream,
+  void callUdpPacketHandler(uint32_t packet_id, PacketReader& reader,
                             Address& addr_from);
-  void callTcpPacketHandler(std::string packet_id, int connection_fd);
+  // Parses the rest of a TCP request, already read in full, and builds the
+  // response to it
+  void callTcpPacketHandler(uint32_t packet_id, PacketReader& reader,
+                            TcpResponse& response);
   ServerGameSync getGame(uint32_t player_id);
   ServerGameSync createGame(uint32_t player_id);
 };
@@ -0,0 +1,273 @@
+#include "tcp_connection.hpp"
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+#include "common/protocol.hpp"
+
+TcpResponse::~TcpResponse() {
+  reset();
+}
+
+size_t TcpResponse::attachFile(const std::filesystem::path &path) {
+  file_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_fd == -1) {
+    throw PacketSerializationException();
+  }
+  struct stat file_stat;
+  if (fstat(file_fd, &file_stat) == -1) {
+    throw PacketSerializationException();
+  }
+  file_size = (size_t)file_stat.st_size;
+  return file_size;
+}
+
+void TcpResponse::attachShared(
+    std::shared_ptr<const std::string> __shared_data) {
+  shared_data = __shared_data;
+}
+
+void TcpResponse::attachHint(std::shared_ptr<CachedHint> __hint) {
+  hint = __hint;
+}
+
+bool TcpResponse::empty() {
+  return data.empty() && body.empty() && shared_data == NULL &&
+         hint == NULL && file_fd == -1 && trailer.empty();
+}
+
+bool TcpResponse::write(int fd) {
+  if (file_fd == -1) {
+    return writeMemory(fd);
+  }
+
+  // The file always follows the header, so partial frames of the header are
+  // held back until it does
+  return writeBytes(fd, data.data(), data.length(), data_sent, true) &&
+         writeFile(fd) &&
+         writeBytes(fd, trailer.data(), trailer.length(), trailer_sent, false);
+}
+
+bool TcpResponse::writeBytes(int fd, const char *bytes, size_t length,
+                             size_t &sent, bool more) {
+  while (sent < length) {
+    ssize_t n = send(fd, bytes + sent, length - sent, more ? MSG_MORE : 0);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
+      }
+      throw ConnectionClosedException();
+    }
+    sent += (size_t)n;
+  }
+  return true;
+}
+
+bool TcpResponse::writeMemory(int fd) {
+  std::string_view segments[] = {
+      data, body, shared_data == NULL ? std::string_view() : *shared_data,
+      hint == NULL ? std::string_view() : hint->header,
+      hint == NULL ? std::string_view() : hint->contents, trailer};
+  size_t total = 0;
+  for (auto &segment : segments) {
+    total += segment.length();
+  }
+
+  while (memory_sent < total) {
+    // Skip what has already been written
+    struct iovec iov[std::size(segments)];
+    int count = 0;
+    size_t skip = memory_sent;
+    for (auto &segment : segments) {
+      if (skip >= segment.length()) {
+        skip -= segment.length();
+        continue;
+      }
+      iov[count].iov_base = (void *)(segment.data() + skip);
+      iov[count].iov_len = segment.length() - skip;
+      skip = 0;
+      ++count;
+    }
+
+    ssize_t n = writev(fd, iov, count);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
+      }
+      throw ConnectionClosedException();
+    }
+    memory_sent += (size_t)n;
+  }
+  return true;
+}
+
+bool TcpResponse::writeFile(int fd) {
+  while (use_sendfile && file_sent < file_size) {
+    off_t offset = (off_t)file_sent;
+    ssize_t n = sendfile(fd, file_fd, &offset, file_size - file_sent);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
+      }
+      if ((errno == EINVAL || errno == ENOSYS) && file_sent == 0) {
+        // The file system does not support it, copy through chunk instead
+        use_sendfile = false;
+        break;
+      }
+      throw ConnectionClosedException();
+    }
+    if (n == 0) {
+      // The file is shorter than announced, so the response can't be
+      // finished
+      throw PacketSerializationException();
+    }
+    file_sent += (size_t)n;
+  }
+
+  while (file_sent < file_size || chunk_sent < chunk_length) {
+    if (chunk_sent == chunk_length) {
+      // Read the next chunk, only once the previous one has been written
+      size_t to_read = std::min(file_size - file_sent, (size_t)FILE_BUFFER_LEN);
+      ssize_t n = pread(file_fd, chunk, to_read, (off_t)file_sent);
+      if (n <= 0) {
+        // The file is shorter than announced, so the response can't be
+        // finished
+        throw PacketSerializationException();
+      }
+      chunk_length = (size_t)n;
+      chunk_sent = 0;
+      file_sent += (size_t)n;
+    }
+    // Only the last chunk is pushed right away, unless a trailer follows it
+    bool more = file_sent < file_size || !trailer.empty();
+    if (!writeBytes(fd, chunk, chunk_length, chunk_sent, more)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TcpResponse::reset() {
+  if (file_fd != -1) {
+    close(file_fd);
+    file_fd = -1;
+  }
+  shared_data.reset();
+  hint.reset();
+  data.clear();
+  body.clear();
+  trailer.clear();
+  memory_sent = 0;
+  data_sent = 0;
+  file_size = 0;
+  file_sent = 0;
+  use_sendfile = true;
+  chunk_length = 0;
+  chunk_sent = 0;
+  trailer_sent = 0;
+  close_connection = false;
+}
+
+TcpConnection::TcpConnection(int __fd, TcpLoop &__loop)
+    : fd{__fd},
+      loop{__loop},
+      last_activity{std::chrono::steady_clock::now()} {
+  idle_timer.data = this;
+  request_timer.data = this;
+}
+
+TcpConnection::~TcpConnection() {
+  close(fd);
+}
+
+bool TcpConnection::isKnownRequest() {
+  if (request_length < PACKET_ID_LEN) {
+    return true;
+  }
+  switch (packet_id_code(request)) {
+    case packet_id_code(ScoreboardServerbound::ID):
+    case packet_id_code(HintServerbound::ID):
+    case packet_id_code(StateServerbound::ID):
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool TcpConnection::readRequest() {
+  while (request_length < TCP_REQUEST_MAX_LEN) {
+    ssize_t n = read(fd, request + request_length,
+                     TCP_REQUEST_MAX_LEN - request_length);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
+      }
+      throw ConnectionClosedException();
+    }
+    if (n == 0) {
+      if (request_length == 0) {
+        throw ConnectionClosedException();
+      }
+      // Let the incomplete request fail to parse, so the client gets an ERR
+      return true;
+    }
+
+    last_activity = std::chrono::steady_clock::now();
+    bool complete = memchr(request + request_length, '\n', (size_t)n) != NULL;
+    request_length += (size_t)n;
+    if (complete || !isKnownRequest()) {
+      return true;
+    }
+  }
+  // Requests are never this long, so it is bound to fail to parse
+  return true;
+}
+
+bool TcpConnection::hasFullRequest() {
+  return memchr(request, '\n', request_length) != NULL ||
+         request_length == TCP_REQUEST_MAX_LEN || !isKnownRequest();
+}
+
+size_t TcpConnection::requestSize() {
+  char *end = (char *)memchr(request, '\n', request_length);
+  if (end == NULL) {
+    return request_length;
+  }
+  return (size_t)(end - request) + 1;
+}
+
+void TcpConnection::nextRequest() {
+  size_t size = requestSize();
+  memmove(request, request + size, request_length - size);
+  request_length -= size;
+  response.reset();
+  status = READING;
+  last_activity = std::chrono::steady_clock::now();
+  ++handled_requests;
+}
+
+bool TcpConnection::isIdle() {
+  return status == READING && handled_requests > 0 && request_length == 0;
+}
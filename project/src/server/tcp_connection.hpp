@@ -0,0 +1,120 @@
+#ifndef TCP_CONNECTION_H
+#define TCP_CONNECTION_H
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "common/constants.hpp"
+#include "hint_cache.hpp"
+#include "timer_wheel.hpp"
+
+class TcpLoop;
+
+// Reply to a TCP request, written to a non-blocking socket bit by bit as it
+// becomes writable: the bytes in data, body and a buffer shared with other
+// responses, optionally followed by a cached hint or the contents of a file,
+// and the bytes in trailer. A body can't be combined with a file. The file is
+// sent with sendfile, so it is never copied to userspace, unless its file
+// system does not support it. Without a file, everything is written with a
+// single writev.
+class TcpResponse {
+  std::shared_ptr<const std::string> shared_data;
+  std::shared_ptr<CachedHint> hint;
+  size_t memory_sent = 0;
+  size_t data_sent = 0;
+  int file_fd = -1;
+  size_t file_size = 0;
+  size_t file_sent = 0;
+  bool use_sendfile = true;
+  char chunk[FILE_BUFFER_LEN];
+  size_t chunk_length = 0;
+  size_t chunk_sent = 0;
+  size_t trailer_sent = 0;
+
+  // Returns false if the socket is not writable anymore. With more, the
+  // kernel is told that more data follows, so it doesn't send a short segment
+  bool writeBytes(int fd, const char* bytes, size_t length, size_t& sent,
+                  bool more);
+  bool writeFile(int fd);
+  bool writeMemory(int fd);
+
+ public:
+  std::string data;
+  std::string body;
+  std::string trailer;
+  // Whether the connection must be closed after this response, even if it is
+  // persistent, because the request stream can't be trusted anymore
+  bool close_connection = false;
+
+  ~TcpResponse();
+  // Opens the file to send after data, returning its size
+  size_t attachFile(const std::filesystem::path& path);
+  // Sends bytes shared with other responses after data, without copying them
+  void attachShared(std::shared_ptr<const std::string> __shared_data);
+  // Sends the hint's header and contents after data
+  void attachHint(std::shared_ptr<CachedHint> __hint);
+  bool empty();
+  // Writes as much as possible without blocking, returning whether the whole
+  // response has been written
+  bool write(int fd);
+  void reset();
+};
+
+// A client connection owned by a TcpLoop. The request is read into a fixed
+// buffer and, once complete, handed to a worker to build the response, which
+// is then written by the loop. Persistent connections then go back to reading
+// the next request, which might have been sent along with the previous one.
+class TcpConnection {
+  // Whether the request received so far might still be valid, so that unknown
+  // requests are replied to without waiting for the rest of them
+  bool isKnownRequest();
+
+ public:
+  enum status { READING, PROCESSING, WRITING };
+  int fd;
+  TcpLoop& loop;
+  status status = READING;
+  char request[TCP_REQUEST_MAX_LEN];
+  size_t request_length = 0;
+  uint32_t handled_requests = 0;
+  TcpResponse response;
+  // Last time data was read or written, to close idle connections
+  std::chrono::steady_clock::time_point last_activity;
+  // Closes the connection once it has been idle for too long, checking
+  // last_activity when it expires instead of being moved on every read or write
+  Timer idle_timer;
+  // Bounds the total time taken to receive a request, however often the client
+  // sends a byte of it
+  Timer request_timer;
+
+  TcpConnection(int __fd, TcpLoop& __loop);
+  ~TcpConnection();
+  // Reads what is available without blocking, returning whether the whole
+  // request has been received
+  bool readRequest();
+  // Whether the bytes already read make up a request that can be handled
+  bool hasFullRequest();
+  // Length of the current request, excluding the bytes of the next ones
+  size_t requestSize();
+  // Drops the handled request and its response, keeping what was read of the
+  // next request
+  void nextRequest();
+  // Whether the connection is waiting for a new request on a persistent
+  // connection, with nothing of it read yet
+  bool isIdle();
+};
+
+/** Exceptions **/
+
+// The peer closed the connection or it failed
+class ConnectionClosedException : public std::runtime_error {
+ public:
+  ConnectionClosedException()
+      : std::runtime_error("The TCP connection has been closed.") {}
+};
+
+#endif
@@ -0,0 +1,417 @@
+#include "tcp_loop.hpp"
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "common/common.hpp"
+#include "common/protocol.hpp"
+#include "logger.hpp"
+
+TcpLoop::TcpLoop(TcpScheduler &__scheduler, int __listen_fd,
+                 bool __keep_alive)
+    : scheduler{__scheduler},
+      listen_fd{__listen_fd},
+      keep_alive{__keep_alive},
+      timers{currentTick()} {
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd == -1) {
+    throw UnrecoverableError("Failed to create TCP loop wake up event", errno);
+  }
+  loop.add(wake_fd, EPOLLIN, [this](uint32_t events) {
+    (void)events;
+    handleWake();
+  });
+
+  // The timer wheel ticks once per second
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (timer_fd == -1) {
+    close(wake_fd);
+    throw UnrecoverableError("Failed to create TCP loop timer", errno);
+  }
+  struct itimerspec interval;
+  interval.it_interval.tv_sec = 1;
+  interval.it_interval.tv_nsec = 0;
+  interval.it_value = interval.it_interval;
+  timerfd_settime(timer_fd, 0, &interval, NULL);
+  loop.add(timer_fd, EPOLLIN, [this](uint32_t events) {
+    (void)events;
+    uint64_t expirations;
+    ssize_t n = read(timer_fd, &expirations, sizeof(expirations));
+    (void)n;
+    timers.advance(currentTick(),
+                   [this](Timer &timer) { handleTimeout(timer); });
+    if (accept_paused) {
+      resumeAccepting();
+    }
+  });
+
+  watchListener();
+
+  thread = std::thread(&TcpLoop::execute, this);
+}
+
+TcpLoop::~TcpLoop() {
+  drain();
+  join();
+  // If the loop failed, workers may still be building responses for its
+  // connections, which must outlive them
+  {
+    std::unique_lock<std::mutex> ulock(lock);
+    requests_done.wait(ulock, [this] { return processing == 0; });
+  }
+  close(timer_fd);
+  close(wake_fd);
+}
+
+uint64_t TcpLoop::currentTick() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void TcpLoop::execute() {
+  try {
+    loop.run();
+  } catch (std::exception &e) {
+    logger.error("TCP loop failed, shutting down... {}", e.what());
+    request_shutdown();
+  }
+}
+
+void TcpLoop::complete(TcpConnection *connection) {
+  std::scoped_lock<std::mutex> slock(lock);
+  completed.push_back(connection);
+  --processing;
+  requests_done.notify_all();
+  uint64_t value = 1;
+  ssize_t n = write(wake_fd, &value, sizeof(value));
+  (void)n;
+}
+
+void TcpLoop::drain() {
+  std::scoped_lock<std::mutex> slock(lock);
+  draining = true;
+  uint64_t value = 1;
+  ssize_t n = write(wake_fd, &value, sizeof(value));
+  (void)n;
+}
+
+void TcpLoop::join() {
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void TcpLoop::handleWake() {
+  uint64_t value;
+  ssize_t n = read(wake_fd, &value, sizeof(value));
+  (void)n;
+
+  std::vector<TcpConnection *> responses;
+  bool should_drain;
+  {
+    std::scoped_lock<std::mutex> slock(lock);
+    responses.swap(completed);
+    should_drain = draining;
+  }
+
+  for (TcpConnection *connection : responses) {
+    startWriting(*connection);
+  }
+
+  if (should_drain) {
+    // The socket stays open, so new connections wait in its queue until the
+    // server exits
+    loop.remove(listen_fd);
+    closeIdleConnections();
+    if (connections.empty()) {
+      loop.stop();
+    }
+  }
+}
+
+void TcpLoop::watchListener() {
+  loop.add(listen_fd, EPOLLIN, [this](uint32_t events) {
+    (void)events;
+    acceptConnections();
+  });
+}
+
+void TcpLoop::pauseAccepting() {
+  loop.remove(listen_fd);
+  accept_paused = true;
+}
+
+void TcpLoop::resumeAccepting() {
+  accept_paused = false;
+  {
+    std::scoped_lock<std::mutex> slock(lock);
+    if (draining) {
+      return;
+    }
+  }
+  try {
+    watchListener();
+  } catch (std::exception &e) {
+    logger.error("Failed to watch TCP listening socket: {}", e.what());
+    accept_paused = true;
+  }
+}
+
+void TcpLoop::acceptConnections() {
+  while (true) {
+    Address addr_from;
+    addr_from.size = sizeof(addr_from.addr);
+    // Timeouts are enforced by the loop, which never blocks on the socket
+    int connection_fd =
+        accept4(listen_fd, (struct sockaddr *)&addr_from.addr, &addr_from.size,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (connection_fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // Accepted everything that was waiting
+        return;
+      }
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      // The connection stays in the backlog, so accepting again right away
+      // would fail the same way. Stop until the next tick of the timer instead.
+      int error = errno;
+      if (error == EMFILE || error == ENFILE || error == ENOBUFS ||
+          error == ENOMEM) {
+        logger.warning(
+            "Out of resources to accept TCP connections, pausing for a "
+            "second: {}",
+            strerror(error));
+      } else {
+        logger.error("Failed to accept a TCP connection: {}", strerror(error));
+      }
+      pauseAccepting();
+      return;
+    }
+
+    logger.info("Receiving incoming TCP connection from {}", addr_from.addr);
+    startReading(connection_fd);
+  }
+}
+
+void TcpLoop::startReading(int connection_fd) {
+  auto connection = std::make_unique<TcpConnection>(connection_fd, *this);
+  TcpConnection *connection_ptr = connection.get();
+  connections.emplace(connection_fd, std::move(connection));
+  scheduleIdleTimeout(*connection_ptr);
+  scheduleRequestTimeout(*connection_ptr);
+  try {
+    loop.add(connection_fd, EPOLLIN, [this, connection_ptr](uint32_t events) {
+      handleEvents(*connection_ptr, events);
+    });
+  } catch (std::exception &e) {
+    logger.error("Failed to watch TCP connection: {}", e.what());
+    closeConnection(*connection_ptr);
+  }
+}
+
+void TcpLoop::startWriting(TcpConnection &connection) {
+  connection.status = TcpConnection::WRITING;
+  connection.last_activity = std::chrono::steady_clock::now();
+  scheduleIdleTimeout(connection);
+  if (connection.response.empty()) {
+    // The request could not be handled, so there is nothing to reply with
+    closeConnection(connection);
+    return;
+  }
+
+  try {
+    if (connection.response.write(connection.fd)) {
+      finishResponse(connection, false);
+      return;
+    }
+    // Wait for the client to accept more data
+    loop.add(connection.fd, EPOLLOUT,
+             [this, connection_ptr = &connection](uint32_t events) {
+               handleEvents(*connection_ptr, events);
+             });
+  } catch (std::exception &e) {
+    logger.debug("Failed to send TCP response: {}", e.what());
+    closeConnection(connection);
+  }
+}
+
+void TcpLoop::handleEvents(TcpConnection &connection, uint32_t events) {
+  (void)events;
+  try {
+    if (connection.status == TcpConnection::READING) {
+      if (!connection.readRequest()) {
+        if (!connection.request_timer.isScheduled() &&
+            connection.request_length > 0) {
+          // The first bytes of a request on a persistent connection
+          scheduleRequestTimeout(connection);
+          scheduleIdleTimeout(connection);
+        }
+        return;
+      }
+      // Not interested in any events until the response is ready
+      loop.remove(connection.fd);
+      processRequest(connection);
+    } else if (connection.status == TcpConnection::WRITING) {
+      connection.last_activity = std::chrono::steady_clock::now();
+      if (connection.response.write(connection.fd)) {
+        finishResponse(connection, true);
+      }
+    }
+  } catch (ConnectionClosedException &e) {
+    logger.debug("TCP connection closed by the client");
+    closeConnection(connection);
+  } catch (std::exception &e) {
+    logger.error("Failed to handle TCP connection: {}", e.what());
+    closeConnection(connection);
+  }
+}
+
+uint64_t TcpLoop::idleDeadline(TcpConnection &connection) {
+  uint64_t timeout = TCP_READ_TIMEOUT_SECONDS;
+  if (connection.status == TcpConnection::WRITING) {
+    timeout = TCP_WRITE_TIMEOUT_SECONDS;
+  } else if (connection.isIdle()) {
+    timeout = TCP_KEEP_ALIVE_IDLE_SECONDS;
+  }
+  auto last_activity = std::chrono::ceil<std::chrono::seconds>(
+      connection.last_activity.time_since_epoch());
+  return (uint64_t)last_activity.count() + timeout;
+}
+
+void TcpLoop::scheduleIdleTimeout(TcpConnection &connection) {
+  timers.schedule(connection.idle_timer, idleDeadline(connection));
+}
+
+void TcpLoop::scheduleRequestTimeout(TcpConnection &connection) {
+  timers.schedule(connection.request_timer,
+                  currentTick() + TCP_REQUEST_TIMEOUT_SECONDS);
+}
+
+void TcpLoop::handleTimeout(Timer &timer) {
+  TcpConnection &connection = *(TcpConnection *)timer.data;
+  if (&timer == &connection.request_timer) {
+    logger.debug("Closing TCP connection that took too long to send a request");
+    ++request_timeouts;
+    closeConnection(connection);
+    return;
+  }
+
+  // The deadline is only moved forward once it expires, so reads and writes
+  // don't have to touch the wheel
+  uint64_t deadline = idleDeadline(connection);
+  if (deadline > currentTick()) {
+    timers.schedule(timer, deadline);
+    return;
+  }
+  logger.debug("Closing idle TCP connection");
+  ++idle_timeouts;
+  closeConnection(connection);
+}
+
+void TcpLoop::processRequest(TcpConnection &connection) {
+  connection.status = TcpConnection::PROCESSING;
+  // Workers have their own deadline for waiting in the queue
+  timers.cancel(connection.idle_timer);
+  timers.cancel(connection.request_timer);
+  {
+    std::scoped_lock<std::mutex> slock(lock);
+    ++processing;
+  }
+  try {
+    scheduler.delegateRequest(&connection);
+  } catch (...) {
+    std::scoped_lock<std::mutex> slock(lock);
+    --processing;
+    throw;
+  }
+}
+
+void TcpLoop::finishResponse(TcpConnection &connection, bool watched) {
+  bool should_drain;
+  {
+    std::scoped_lock<std::mutex> slock(lock);
+    should_drain = draining;
+  }
+  if (!keep_alive || connection.response.close_connection || should_drain) {
+    closeConnection(connection);
+    return;
+  }
+
+  connection.nextRequest();
+  scheduleIdleTimeout(connection);
+  if (connection.request_length > 0) {
+    scheduleRequestTimeout(connection);
+  }
+  if (connection.hasFullRequest()) {
+    // The client sent the next request along with the previous one
+    loop.remove(connection.fd);
+    processRequest(connection);
+  } else if (watched) {
+    loop.modify(connection.fd, EPOLLIN);
+  } else {
+    loop.add(connection.fd, EPOLLIN,
+             [this, connection_ptr = &connection](uint32_t events) {
+               handleEvents(*connection_ptr, events);
+             });
+  }
+}
+
+void TcpLoop::closeIdleConnections() {
+  std::vector<TcpConnection *> idle;
+  for (auto &entry : connections) {
+    if (entry.second->isIdle()) {
+      idle.push_back(entry.second.get());
+    }
+  }
+  for (TcpConnection *connection : idle) {
+    closeConnection(*connection);
+  }
+}
+
+void TcpLoop::closeConnection(TcpConnection &connection) {
+  logger.debug("Closing TCP connection...");
+  loop.remove(connection.fd);
+  // Closes the socket as well
+  connections.erase(connection.fd);
+
+  std::scoped_lock<std::mutex> slock(lock);
+  if (draining && connections.empty()) {
+    loop.stop();
+  }
+}
+
+TcpLoopGroup::TcpLoopGroup(TcpScheduler &scheduler,
+                           const std::vector<int> &listen_fds,
+                           bool keep_alive) {
+  for (int listen_fd : listen_fds) {
+    loops.push_back(
+        std::make_unique<TcpLoop>(scheduler, listen_fd, keep_alive));
+  }
+}
+
+TcpLoopGroup::~TcpLoopGroup() {
+  shutdown();
+}
+
+void TcpLoopGroup::shutdown() {
+  for (auto &loop : loops) {
+    loop->drain();
+  }
+  for (auto &loop : loops) {
+    loop->join();
+    idle_timeouts += loop->idle_timeouts;
+    request_timeouts += loop->request_timeouts;
+  }
+  loops.clear();
+}
+
+void TcpLoopGroup::logStats() {
+  logger.info(
+      "[TCP] Closed {} idle connection(s) and {} taking too long to send a "
+      "request",
+      idle_timeouts, request_timeouts);
+}
@@ -0,0 +1,104 @@
+#ifndef TCP_LOOP_H
+#define TCP_LOOP_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "event_loop.hpp"
+#include "tcp_connection.hpp"
+#include "tcp_scheduler.hpp"
+#include "timer_wheel.hpp"
+
+// Thread that owns a set of non-blocking TCP connections and drives them with
+// an event loop: it accepts them from its own listening socket, reads
+// requests, hands them to the scheduler and writes back the responses.
+// A slow client only costs the memory of its connection, not a whole thread.
+// With keep_alive, connections are kept open after a response, until the
+// client closes them or stays idle for too long.
+// Each connection has an idle deadline, moved by every read or write, and a
+// deadline for receiving the whole request, both kept in a timer wheel ticking
+// once per second, so timeouts cost the same with any number of connections.
+class TcpLoop {
+  EventLoop loop{false};
+  TcpScheduler& scheduler;
+  int listen_fd;
+  bool keep_alive;
+  // Declared before the connections, so their timers are dropped first
+  TimerWheel timers;
+  std::unordered_map<int, std::unique_ptr<TcpConnection>> connections;
+  // Wakes up the loop when other threads hand it something
+  int wake_fd = -1;
+  int timer_fd = -1;
+  // Whether the listening socket was taken out of the loop after accept
+  // failed, until the next tick
+  bool accept_paused = false;
+
+  std::mutex lock;
+  std::vector<TcpConnection*> completed;
+  bool draining = false;
+  // Requests handed to the scheduler whose response is not complete yet
+  uint32_t processing = 0;
+  std::condition_variable requests_done;
+
+  std::thread thread;
+
+  static uint64_t currentTick();
+  void execute();
+  void handleWake();
+  void watchListener();
+  void pauseAccepting();
+  void resumeAccepting();
+  void acceptConnections();
+  void handleEvents(TcpConnection& connection, uint32_t events);
+  void handleTimeout(Timer& timer);
+  // Tick at which the connection is idle for too long, given its status
+  uint64_t idleDeadline(TcpConnection& connection);
+  // (Re)schedules the idle deadline for the connection's current status
+  void scheduleIdleTimeout(TcpConnection& connection);
+  void scheduleRequestTimeout(TcpConnection& connection);
+  void startReading(int connection_fd);
+  void processRequest(TcpConnection& connection);
+  void startWriting(TcpConnection& connection);
+  // Called once the whole response has been written. Watched tells whether
+  // the connection is still registered in the event loop.
+  void finishResponse(TcpConnection& connection, bool watched);
+  void closeConnection(TcpConnection& connection);
+  void closeIdleConnections();
+
+ public:
+  // Connections closed for being idle and for taking too long to send a
+  // request, which must only be read once the loop has exited
+  uint64_t idle_timeouts = 0;
+  uint64_t request_timeouts = 0;
+
+  TcpLoop(TcpScheduler& __scheduler, int __listen_fd, bool __keep_alive);
+  ~TcpLoop();
+  // Called by a worker once the response to the connection's request is ready
+  void complete(TcpConnection* connection);
+  // Makes the loop exit once all of its connections are closed
+  void drain();
+  // Waits for the loop to exit
+  void join();
+};
+
+// The TCP loops, one for each listening socket
+class TcpLoopGroup {
+  std::vector<std::unique_ptr<TcpLoop>> loops;
+  uint64_t idle_timeouts = 0;
+  uint64_t request_timeouts = 0;
+
+ public:
+  TcpLoopGroup(TcpScheduler& scheduler, const std::vector<int>& listen_fds,
+               bool keep_alive);
+  ~TcpLoopGroup();
+  // Stops accepting connections and waits for all of them to be closed
+  void shutdown();
+  // Logs how many connections timed out, once the loops have been shut down
+  void logStats();
+};
+
+#endif
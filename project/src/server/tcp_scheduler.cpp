@@ -0,0 +1,35 @@
+#include "tcp_scheduler.hpp"
+
+#include <algorithm>
+
+#include "common/protocol.hpp"
+
+TcpScheduler::TcpScheduler(GameServerState &server_state)
+    : small_lane{server_state, server_state.tcp_min_workers,
+                 server_state.tcp_max_workers, "small lane"},
+      bulk_lane{server_state,
+                std::min((uint32_t)TCP_BULK_WORKER_POOL_MIN,
+                         server_state.tcp_bulk_workers),
+                server_state.tcp_bulk_workers, "bulk lane"} {}
+
+void TcpScheduler::delegateRequest(TcpConnection *connection) {
+  // Only the packet ID is looked at, the worker parses the whole request.
+  // Anything that is not a hint request is cheap to reply to, even an ERR.
+  if (connection->requestSize() >= PACKET_ID_LEN &&
+      packet_id_code(connection->request) ==
+          packet_id_code(HintServerbound::ID)) {
+    bulk_lane.delegateRequest(connection);
+  } else {
+    small_lane.delegateRequest(connection);
+  }
+}
+
+void TcpScheduler::shutdown() {
+  small_lane.shutdown();
+  bulk_lane.shutdown();
+}
+
+void TcpScheduler::logStats() {
+  small_lane.logStats();
+  bulk_lane.logStats();
+}
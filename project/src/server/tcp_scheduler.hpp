@@ -0,0 +1,25 @@
+#ifndef TCP_SCHEDULER_H
+#define TCP_SCHEDULER_H
+
+#include "server_state.hpp"
+#include "tcp_connection.hpp"
+#include "worker_pool.hpp"
+
+// Routes each TCP request, by its packet ID, to one of two worker pools with
+// their own queue and threads. Hint requests, which may have to load a whole
+// file from disk, go to the bulk lane, while scoreboard and state requests go
+// to the small lane, so a wave of hint downloads never delays them.
+class TcpScheduler {
+  WorkerPool small_lane;
+  WorkerPool bulk_lane;
+
+ public:
+  explicit TcpScheduler(GameServerState& server_state);
+  // Queues the connection's request in its lane
+  void delegateRequest(TcpConnection* connection);
+  // Waits for all queued and on-going requests to be handled
+  void shutdown();
+  void logStats();
+};
+
+#endif
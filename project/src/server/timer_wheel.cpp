@@ -0,0 +1,97 @@
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+
+Timer::~Timer() {
+  unlink();
+}
+
+bool Timer::isScheduled() {
+  return next != this;
+}
+
+void Timer::unlink() {
+  prev->next = next;
+  next->prev = prev;
+  prev = this;
+  next = this;
+}
+
+void Timer::append(Timer &timer) {
+  timer.prev = prev;
+  timer.next = this;
+  prev->next = &timer;
+  prev = &timer;
+}
+
+TimerWheel::TimerWheel(uint64_t now_tick) : current_tick{now_tick} {}
+
+void TimerWheel::schedule(Timer &timer, uint64_t expires_tick) {
+  timer.unlink();
+  timer.expires = expires_tick;
+  place(timer, current_tick + 1);
+}
+
+void TimerWheel::cancel(Timer &timer) {
+  timer.unlink();
+}
+
+void TimerWheel::place(Timer &timer, uint64_t earliest_tick) {
+  uint64_t tick = std::max(timer.expires, earliest_tick);
+  uint64_t delta = tick - current_tick;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+    int shift = TIMER_WHEEL_BITS * level;
+    if (delta < SLOTS << shift) {
+      slots[level][(tick >> shift) & MASK].append(timer);
+      return;
+    }
+  }
+  // Beyond the last level, so park it in the last slot to come up, from where
+  // it will be placed again
+  int shift = TIMER_WHEEL_BITS * (TIMER_WHEEL_LEVELS - 1);
+  slots[TIMER_WHEEL_LEVELS - 1][((current_tick >> shift) + MASK) & MASK].append(
+      timer);
+}
+
+void TimerWheel::advance(uint64_t now_tick,
+                         const std::function<void(Timer &)> &expired) {
+  while (current_tick < now_tick) {
+    ++current_tick;
+
+    // Move the timers of the slots that just came up on the upper levels down,
+    // starting with the highest, so they can cascade all the way to level 0
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+      int shift = TIMER_WHEEL_BITS * level;
+      if ((current_tick & ((1ULL << shift) - 1)) != 0) {
+        continue;
+      }
+      Timer pending;
+      Timer &slot = slots[level][(current_tick >> shift) & MASK];
+      while (slot.isScheduled()) {
+        Timer &timer = *slot.next;
+        timer.unlink();
+        pending.append(timer);
+      }
+      while (pending.isScheduled()) {
+        Timer &timer = *pending.next;
+        timer.unlink();
+        place(timer, current_tick);
+      }
+    }
+
+    // The expired timers are taken out of the slot first, so the callback can
+    // cancel any of them, or schedule the expired one again
+    Timer due;
+    Timer &slot = slots[0][current_tick & MASK];
+    while (slot.isScheduled()) {
+      Timer &timer = *slot.next;
+      timer.unlink();
+      due.append(timer);
+    }
+    while (due.isScheduled()) {
+      Timer &timer = *due.next;
+      timer.unlink();
+      expired(timer);
+    }
+  }
+}
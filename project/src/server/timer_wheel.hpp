@@ -0,0 +1,61 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstdint>
+#include <functional>
+
+#include "common/constants.hpp"
+
+class TimerWheel;
+
+// Intrusive timer, meant to be embedded in whatever it times out, so
+// scheduling and cancelling it never allocates
+class Timer {
+  friend class TimerWheel;
+
+  Timer* prev = this;
+  Timer* next = this;
+  uint64_t expires = 0;
+
+  void unlink();
+  void append(Timer& timer);
+
+ public:
+  void* data = NULL;
+
+  Timer() = default;
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+  ~Timer();
+  bool isScheduled();
+};
+
+// Hierarchical timing wheel with TIMER_WHEEL_LEVELS levels of
+// 2^TIMER_WHEEL_BITS slots. A slot on level 0 holds the timers expiring on a
+// single tick, and each slot on the levels above covers a whole turn of the
+// level below, whose timers are moved down once it comes up. Scheduling,
+// cancelling and expiring a timer all take constant time, no matter how many
+// timers there are.
+class TimerWheel {
+  static constexpr uint64_t SLOTS = 1 << TIMER_WHEEL_BITS;
+  static constexpr uint64_t MASK = SLOTS - 1;
+
+  // Each slot is the head of a circular list
+  Timer slots[TIMER_WHEEL_LEVELS][SLOTS];
+  uint64_t current_tick;
+
+  // Puts the timer in the slot of its expiration tick, or of earliest_tick if
+  // it is already due
+  void place(Timer& timer, uint64_t earliest_tick);
+
+ public:
+  explicit TimerWheel(uint64_t now_tick);
+  // Schedules the timer, or reschedules it if it already was
+  void schedule(Timer& timer, uint64_t expires_tick);
+  void cancel(Timer& timer);
+  // Runs the callback for every timer that expired up to now. The callback
+  // may schedule or cancel any timer, including the expired one.
+  void advance(uint64_t now_tick, const std::function<void(Timer&)>& expired);
+};
+
+#endif
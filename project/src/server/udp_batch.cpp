@@ -0,0 +1,177 @@
+#include "udp_batch.hpp"
+
+#include <cstring>
+
+#include "common/common.hpp"
+#include "logger.hpp"
+
+double UdpBatchStats::averageBatchSize() {
+  if (batches == 0) {
+    return 0;
+  }
+  return (double)packets / (double)batches;
+}
+
+double UdpBatchStats::averageFlushSize() {
+  if (flushes == 0) {
+    return 0;
+  }
+  return (double)replies / (double)flushes;
+}
+
+void UdpBatchStats::add(UdpBatchStats &other) {
+  batches += other.batches;
+  packets += other.packets;
+  flushes += other.flushes;
+  replies += other.replies;
+  rate_limited_sources += other.rate_limited_sources;
+  rate_limited_players += other.rate_limited_players;
+}
+
+void UdpBatchStats::print(std::ostream &stream, double uptime_seconds) {
+  stream << "Received " << packets << " UDP packet(s) in " << batches
+         << " batch(es), average batch size: " << averageBatchSize();
+  if (uptime_seconds > 0) {
+    stream << ", " << (double)packets / uptime_seconds << " packet(s)/s";
+  }
+  stream << std::endl;
+  stream << "Sent " << replies << " UDP reply(ies) in " << flushes
+         << " flush(es), average flush size: " << averageFlushSize()
+         << std::endl;
+  if (rate_limited_sources > 0 || rate_limited_players > 0) {
+    stream << "Dropped " << rate_limited_sources
+           << " UDP packet(s) over the source address rate limit and "
+           << rate_limited_players << " over the player ID rate limit"
+           << std::endl;
+  }
+}
+
+UdpBatch::UdpBatch() {
+  memset(in_headers, 0, sizeof(in_headers));
+  memset(out_headers, 0, sizeof(out_headers));
+  for (uint32_t i = 0; i < UDP_BATCH_SIZE; ++i) {
+    in_iovecs[i].iov_base = in_buffers[i];
+    in_iovecs[i].iov_len = SOCKET_BUFFER_LEN;
+    in_headers[i].msg_hdr.msg_iov = &in_iovecs[i];
+    in_headers[i].msg_hdr.msg_iovlen = 1;
+    in_headers[i].msg_hdr.msg_name = &in_addresses[i].addr;
+    in_addresses[i].batch = this;
+
+    out_iovecs[i].iov_base = out_buffers[i];
+    out_headers[i].msg_hdr.msg_iov = &out_iovecs[i];
+    out_headers[i].msg_hdr.msg_iovlen = 1;
+    out_headers[i].msg_hdr.msg_name = &out_addresses[i];
+  }
+}
+
+int UdpBatch::receive(int socket) {
+  received = 0;
+  for (uint32_t i = 0; i < UDP_BATCH_SIZE; ++i) {
+    in_headers[i].msg_hdr.msg_namelen = sizeof(in_addresses[i].addr);
+  }
+
+  // Block until at least one datagram arrives, then take whatever else is
+  // already waiting in the socket buffer
+  int n = recvmmsg(socket, in_headers, UDP_BATCH_SIZE, MSG_WAITFORONE, NULL);
+  if (n <= 0) {
+    return n;
+  }
+
+  received = (uint32_t)n;
+  for (uint32_t i = 0; i < received; ++i) {
+    in_addresses[i].socket = socket;
+    in_addresses[i].size = in_headers[i].msg_hdr.msg_namelen;
+  }
+  stats.batches++;
+  stats.packets += received;
+  return n;
+}
+
+uint32_t UdpBatch::size() {
+  return received;
+}
+
+Address &UdpBatch::getAddress(uint32_t index) {
+  return in_addresses[index];
+}
+
+char *UdpBatch::getData(uint32_t index) {
+  return in_buffers[index];
+}
+
+size_t UdpBatch::getLength(uint32_t index) {
+  return in_headers[index].msg_len;
+}
+
+void UdpBatch::queueReply(UdpPacket &packet, Address &addr_to) {
+  if (queued >= UDP_BATCH_SIZE) {
+    flushReplies(addr_to.socket);
+  }
+
+  // Serialize straight into the slot that will be handed to sendmmsg
+  UdpPacketWriter writer(out_buffers[queued], SOCKET_BUFFER_LEN);
+  packet.serialize(writer);
+  commitReply(writer.getLength(), addr_to);
+}
+
+void UdpBatch::queueReply(std::string_view data, Address &addr_to) {
+  if (data.length() > SOCKET_BUFFER_LEN) {
+    throw PacketSerializationException();
+  }
+  if (queued >= UDP_BATCH_SIZE) {
+    flushReplies(addr_to.socket);
+  }
+
+  memcpy(out_buffers[queued], data.data(), data.length());
+  commitReply(data.length(), addr_to);
+}
+
+void UdpBatch::commitReply(size_t length, Address &addr_to) {
+  out_iovecs[queued].iov_len = length;
+  out_addresses[queued] = addr_to.addr;
+  out_headers[queued].msg_hdr.msg_namelen = addr_to.size;
+  ++queued;
+}
+
+void UdpBatch::flushReplies(int socket) {
+  uint32_t sent = 0;
+  if (queued > 0) {
+    stats.flushes++;
+  }
+  while (sent < queued) {
+    int n = sendmmsg(socket, &out_headers[sent], queued - sent, 0);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Drop the reply that failed to send and carry on with the others
+      logger.error("Failed to send UDP reply: {}", strerror(errno));
+      ++sent;
+      continue;
+    }
+    sent += (uint32_t)n;
+    stats.replies += (uint32_t)n;
+  }
+  queued = 0;
+}
+
+void send_udp_reply(UdpPacket &packet, Address &addr_to) {
+  if (addr_to.batch != NULL) {
+    addr_to.batch->queueReply(packet, addr_to);
+    return;
+  }
+  send_packet(packet, addr_to.socket, (struct sockaddr *)&addr_to.addr,
+              addr_to.size);
+}
+
+void send_udp_reply(std::string_view data, Address &addr_to) {
+  if (addr_to.batch != NULL) {
+    addr_to.batch->queueReply(data, addr_to);
+    return;
+  }
+  ssize_t n = sendto(addr_to.socket, data.data(), data.length(), 0,
+                     (struct sockaddr *)&addr_to.addr, addr_to.size);
+  if (n == -1) {
+    throw UnrecoverableError("Failed to send UDP packet", errno);
+  }
+}
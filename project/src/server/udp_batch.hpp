@@ -0,0 +1,67 @@
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+#include "common/constants.hpp"
+#include "common/protocol.hpp"
+#include "server_state.hpp"
+
+class UdpBatchStats {
+ public:
+  uint64_t batches = 0;
+  uint64_t packets = 0;
+  uint64_t flushes = 0;
+  uint64_t replies = 0;
+  uint64_t rate_limited_sources = 0;
+  uint64_t rate_limited_players = 0;
+
+  double averageBatchSize();
+  double averageFlushSize();
+  void add(UdpBatchStats& other);
+  void print(std::ostream& stream, double uptime_seconds);
+};
+
+// Receives up to UDP_BATCH_SIZE datagrams with a single recvmmsg call and
+// collects the replies to them, so they can be sent with a single sendmmsg
+class UdpBatch {
+  struct mmsghdr in_headers[UDP_BATCH_SIZE];
+  struct iovec in_iovecs[UDP_BATCH_SIZE];
+  char in_buffers[UDP_BATCH_SIZE][SOCKET_BUFFER_LEN];
+  Address in_addresses[UDP_BATCH_SIZE];
+  uint32_t received = 0;
+
+  struct mmsghdr out_headers[UDP_BATCH_SIZE];
+  struct iovec out_iovecs[UDP_BATCH_SIZE];
+  char out_buffers[UDP_BATCH_SIZE][SOCKET_BUFFER_LEN];
+  struct sockaddr_in out_addresses[UDP_BATCH_SIZE];
+  uint32_t queued = 0;
+
+  void commitReply(size_t length, Address& addr_to);
+
+ public:
+  UdpBatchStats stats;
+
+  UdpBatch();
+  int receive(int socket);
+  uint32_t size();
+  Address& getAddress(uint32_t index);
+  char* getData(uint32_t index);
+  size_t getLength(uint32_t index);
+  void queueReply(UdpPacket& packet, Address& addr_to);
+  void queueReply(std::string_view data, Address& addr_to);
+  void flushReplies(int socket);
+};
+
+// Replies to a UDP packet, queueing it in the batch the request came from,
+// if there is one, or sending it right away otherwise
+void send_udp_reply(UdpPacket& packet, Address& addr_to);
+// Same as above, for a reply that has already been serialized
+void send_udp_reply(std::string_view data, Address& addr_to);
+
+#endif
@@ -1,115 +1,194 @@
 #include "worker_pool.hpp"
 
-#include <unistd.h>
-
-#include <iostream>
+#include <algorithm>
+#include <system_error>
 
 #include "common/protocol.hpp"
+#include "logger.hpp"
+#include "tcp_loop.hpp"
 
-Worker::Worker() {
-  thread = std::thread(&Worker::execute, this);
+void ConnectionQueue::push(PendingConnection &connection) {
+  entries[(head + count) % TCP_CONNECTION_QUEUE_SIZE] = connection;
+  ++count;
 }
 
-Worker::~Worker() {
-  lock.lock();
-  shutdown = true;
-  cond.notify_one();
-  lock.unlock();
-  thread.join();
+PendingConnection ConnectionQueue::pop() {
+  PendingConnection connection = entries[head];
+  head = (head + 1) % TCP_CONNECTION_QUEUE_SIZE;
+  --count;
+  return connection;
 }
 
-void Worker::execute() {
-  while (!shutdown) {
-    std::unique_lock<std::mutex> unique_lock(lock);
-    try {
-      while (!to_execute && !shutdown) {
-        cond.wait(unique_lock);
-      }
-
-      if (shutdown) {
-        return;
-      }
-
-      std::string packet_id = read_packet_id(tcp_socket_fd);
+double WorkerPoolStats::averageWaitMilliseconds() {
+  uint64_t dequeued = handled + expired;
+  if (dequeued == 0) {
+    return 0;
+  }
+  return (double)total_wait_us / (double)dequeued / 1000.0;
+}
 
-      pool->server_state.callTcpPacketHandler(packet_id, tcp_socket_fd);
+WorkerPool::WorkerPool(GameServerState &__server_state,
+                       uint32_t __min_workers, uint32_t __max_workers,
+                       const std::string &__name)
+    : min_workers{__min_workers},
+      max_workers{__max_workers},
+      name{__name},
+      server_state{__server_state} {
+  std::scoped_lock<std::mutex> slock(lock);
+  for (uint32_t i = 0; i < min_workers; ++i) {
+    spawnWorker();
+  }
+}
 
-    } catch (InvalidPacketException &e) {
-      try {
-        ErrorTcpPacket error_packet;
-        error_packet.send(tcp_socket_fd);
-      } catch (...) {
-        std::cerr << "Failed to reply with ERR packet" << std::endl;
-      }
-    } catch (std::exception &e) {
-      std::cerr << "Worker #" << worker_id
-                << " encountered an exception while running: " << e.what()
-                << std::endl;
-    } catch (...) {
-      std::cerr << "Worker #" << worker_id
-                << " encountered an unknown exception while running."
-                << std::endl;
-    }
+WorkerPool::~WorkerPool() {
+  shutdown();
+}
 
-    pool->server_state.cdebug << "[Worker #" << worker_id
-                              << "] Closing connection..." << std::endl;
-    close(tcp_socket_fd);
-    to_execute = false;
-    pool->freeWorker(worker_id);
-  }
+void WorkerPool::spawnWorker() {
+  // Must be called with the lock held, so the new thread can only look at the
+  // pool after it has been registered
+  joinExitedWorkers();
+  uint32_t worker_id = next_worker_id++;
+  workers.emplace(worker_id,
+                  std::thread(&WorkerPool::execute, this, worker_id));
+  stats.max_workers = std::max(stats.max_workers, workers.size());
+  logger.debug("Started TCP {} worker #{}, {} running", name, worker_id,
+               workers.size());
 }
 
-WorkerPool::WorkerPool(GameServerState &__server_state)
-    : server_state{__server_state} {
-  for (uint32_t i = 0; i < TCP_WORKER_POOL_SIZE; ++i) {
-    busy_threads[i] = false;
-    workers[i].pool = this;
-    workers[i].worker_id = i;
+void WorkerPool::joinExitedWorkers() {
+  for (std::thread &thread : exited_workers) {
+    thread.join();
   }
+  exited_workers.clear();
 }
 
-void WorkerPool::delegateConnection(int connection_fd) {
-  std::scoped_lock<std::mutex> slock(busy_threads_lock);
+void WorkerPool::delegateRequest(TcpConnection *connection) {
+  std::scoped_lock<std::mutex> slock(lock);
+  if (queue.full()) {
+    stats.rejected++;
+    throw ConnectionQueueFullException();
+  }
 
-  for (size_t i = 0; i < TCP_WORKER_POOL_SIZE; ++i) {
-    if (!busy_threads[i]) {
-      // Found an available worker!
-      std::scoped_lock<std::mutex> worker_lock(workers[i].lock);
+  // The worker is started before the request is queued, so if that fails,
+  // the loop closes the connection without the queue still pointing to it
+  if (idle_workers < queue.size() + 1 && workers.size() < max_workers) {
+    try {
+      spawnWorker();
+    } catch (std::system_error &e) {
+      if (workers.empty()) {
+        throw;
+      }
+      logger.warning("Failed to start a TCP {} worker, {} running: {}", name,
+                     workers.size(), e.what());
+    }
+  }
 
-      busy_threads[i] = true;
-      workers[i].tcp_socket_fd = connection_fd;
-      workers[i].to_execute = true;
+  PendingConnection pending;
+  pending.connection = connection;
+  pending.queued_at = std::chrono::steady_clock::now();
+  queue.push(pending);
+  stats.max_queue_depth = std::max(stats.max_queue_depth, queue.size());
+  work_available.notify_one();
+}
 
-      workers[i].cond.notify_one();
+void WorkerPool::execute(uint32_t worker_id) {
+  std::unique_lock<std::mutex> ulock(lock);
+  while (true) {
+    ++idle_workers;
+    bool timed_out = !work_available.wait_for(
+        ulock, std::chrono::seconds(TCP_WORKER_IDLE_SECONDS),
+        [this] { return !queue.empty() || shutting_down; });
+    --idle_workers;
+
+    if (queue.empty() &&
+        (shutting_down || (timed_out && workers.size() > min_workers))) {
+      break;
+    }
+    if (queue.empty()) {
+      continue;
+    }
 
-      server_state.cdebug << "Delegated to worker #" << i << std::endl;
-      return;
+    PendingConnection pending = queue.pop();
+    uint64_t wait_us =
+        (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - pending.queued_at)
+            .count();
+    stats.total_wait_us += wait_us;
+    stats.max_wait_us = std::max(stats.max_wait_us, wait_us);
+
+    if (wait_us > (uint64_t)TCP_CONNECTION_QUEUE_TIMEOUT_SECONDS * 1000000) {
+      // The client has most likely given up by now, so the connection is
+      // handed back without a response, to be closed
+      stats.expired++;
+      ulock.unlock();
+      logger.warning("TCP request waited {} ms for a {} worker, closing it",
+                     wait_us / 1000, name);
+      pending.connection->loop.complete(pending.connection);
+      ulock.lock();
+      continue;
     }
+
+    stats.handled++;
+    ulock.unlock();
+    handleRequest(worker_id, *pending.connection);
+    ulock.lock();
   }
 
-  throw NoWorkersAvailableException();
+  // Hand the thread over to be joined by whoever spawns the next one
+  auto it = workers.find(worker_id);
+  exited_workers.push_back(std::move(it->second));
+  workers.erase(it);
+  logger.debug("Stopped TCP {} worker #{}, {} running", name, worker_id,
+               workers.size());
+  worker_exited.notify_all();
 }
 
-void WorkerPool::freeWorker(uint32_t worker_id) {
-  std::scoped_lock<std::mutex> slock(busy_threads_lock);
-  if (worker_id < TCP_WORKER_POOL_SIZE) {
-    busy_threads[worker_id] = false;
+void WorkerPool::handleRequest(uint32_t worker_id,
+                               TcpConnection &connection) {
+  TcpResponse &response = connection.response;
+  try {
+    PacketReader reader(connection.request, connection.requestSize());
+    uint32_t packet_id = reader.readAnyPacketId();
+
+    server_state.callTcpPacketHandler(packet_id, reader, response);
+
+  } catch (InvalidPacketException &e) {
+    response.reset();
+    ErrorTcpPacket error_packet;
+    error_packet.serialize(response.data);
+    response.close_connection = true;
+  } catch (std::exception &e) {
+    response.reset();
+    logger.error("Worker #{} encountered an exception while running: {}",
+                 worker_id, e.what());
+  } catch (...) {
+    response.reset();
+    logger.error("Worker #{} encountered an unknown exception while running.",
+                 worker_id);
   }
-}
 
-std::string read_packet_id(int fd) {
-  char id[PACKET_ID_LEN + 1];
-  size_t to_read = PACKET_ID_LEN;
+  connection.loop.complete(&connection);
+}
 
-  while (to_read > 0) {
-    ssize_t n = read(fd, &id[PACKET_ID_LEN - to_read], to_read);
-    if (n <= 0) {
-      std::cerr << "Received malformated packet ID" << std::endl;
-      throw InvalidPacketException();
-    }
-    to_read -= (size_t)n;
-  }
+void WorkerPool::shutdown() {
+  std::unique_lock<std::mutex> ulock(lock);
+  shutting_down = true;
+  work_available.notify_all();
+  worker_exited.wait(ulock, [this] { return workers.empty(); });
+  joinExitedWorkers();
+}
 
-  id[PACKET_ID_LEN] = '\0';
-  return std::string(id);
+void WorkerPool::logStats() {
+  std::scoped_lock<std::mutex> slock(lock);
+  logger.info(
+      "[TCP {}] Handled {} request(s), average wait for a worker: {} ms, "
+      "longest: {} ms",
+      name, stats.handled, stats.averageWaitMilliseconds(),
+      (double)stats.max_wait_us / 1000.0);
+  logger.info(
+      "[TCP {}] Up to {} request(s) queued and {} worker thread(s) running, "
+      "{} expired in the queue, {} rejected with a full queue",
+      name, stats.max_queue_depth, stats.max_workers, stats.expired,
+      stats.rejected);
 }
@@ -1,54 +1,106 @@
 #ifndef WORKER_POOL_H
 #define WORKER_POOL_H
 
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "common/constants.hpp"
 #include "server_state.hpp"
+#include "tcp_connection.hpp"
 
-class WorkerPool;
+class PendingConnection {
+ public:
+  TcpConnection* connection;
+  std::chrono::steady_clock::time_point queued_at;
+};
 
-class Worker {
-  std::thread thread;
+// Fixed-capacity FIFO of connections whose requests are waiting for a worker.
+// It is not synchronized by itself, the pool only accesses it with its lock
+// held.
+class ConnectionQueue {
+  PendingConnection entries[TCP_CONNECTION_QUEUE_SIZE];
+  size_t head = 0;
+  size_t count = 0;
 
-  void execute();
+ public:
+  bool empty() {
+    return count == 0;
+  }
+  bool full() {
+    return count == TCP_CONNECTION_QUEUE_SIZE;
+  }
+  size_t size() {
+    return count;
+  }
+  void push(PendingConnection& connection);
+  PendingConnection pop();
+};
 
+class WorkerPoolStats {
  public:
-  int tcp_socket_fd = -1;
-  bool shutdown = false;
-  bool to_execute = false;
-  WorkerPool *pool;
-  uint32_t worker_id = 0;
-  std::mutex lock;
-  std::condition_variable cond;
+  uint64_t handled = 0;
+  uint64_t expired = 0;
+  uint64_t rejected = 0;
+  uint64_t total_wait_us = 0;
+  uint64_t max_wait_us = 0;
+  size_t max_queue_depth = 0;
+  size_t max_workers = 0;
 
-  Worker();
-  ~Worker();
+  double averageWaitMilliseconds();
 };
 
+// Pool of threads building the responses to TCP requests, which are queued
+// until a worker is free. Workers never touch the sockets themselves, so they
+// are never held up by slow clients. The pool starts with min_workers threads
+// and grows up to max_workers when requests are waiting, while workers that
+// stay idle for TCP_WORKER_IDLE_SECONDS exit until only min_workers are left.
 class WorkerPool {
-  Worker workers[TCP_WORKER_POOL_SIZE];
-  bool busy_threads[TCP_WORKER_POOL_SIZE];
-  std::mutex busy_threads_lock;
+  std::mutex lock;
+  std::condition_variable work_available;
+  std::condition_variable worker_exited;
+  ConnectionQueue queue;
+  std::unordered_map<uint32_t, std::thread> workers;
+  // Threads that have exited, but still have to be joined
+  std::vector<std::thread> exited_workers;
+  uint32_t idle_workers = 0;
+  uint32_t next_worker_id = 0;
+  uint32_t min_workers;
+  uint32_t max_workers;
+  // Used in the logs to tell the pools apart
+  std::string name;
+  bool shutting_down = false;
+
+  void spawnWorker();
+  void joinExitedWorkers();
+  void execute(uint32_t worker_id);
+  void handleRequest(uint32_t worker_id, TcpConnection& connection);
 
  public:
-  GameServerState &server_state;
+  GameServerState& server_state;
+  WorkerPoolStats stats;
 
-  WorkerPool(GameServerState &__server_state);
-  void delegateConnection(int connection_fd);
-  void freeWorker(uint32_t worker_id);
+  WorkerPool(GameServerState& __server_state, uint32_t __min_workers,
+             uint32_t __max_workers, const std::string& __name);
+  ~WorkerPool();
+  // Queues the connection's request. Once its response is ready, the
+  // connection is handed back to its loop.
+  void delegateRequest(TcpConnection* connection);
+  // Waits for all queued and on-going requests to be handled
+  void shutdown();
+  void logStats();
 };
 
-std::string read_packet_id(int fd);
-
-class NoWorkersAvailableException : public std::runtime_error {
+class ConnectionQueueFullException : public std::runtime_error {
  public:
-  NoWorkersAvailableException()
+  ConnectionQueueFullException()
       : std::runtime_error(
-            "All TCP workers are busy, cannot handle the incoming "
-            "connection.") {}
+            "Too many TCP requests are waiting for a worker, cannot handle "
+            "the incoming request.") {}
 };
 
 #endif